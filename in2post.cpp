@@ -15,15 +15,34 @@
 * expression components.
 */
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <new>
 #include <regex>
 #include <sstream>
 #include <string>
+#include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 #include "stack.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IN2POST_X86 1
+#endif
+
 using namespace std;
 
 //------------------------------------------------------------------------------
@@ -59,6 +78,145 @@ namespace cop4530 {
     */
     string evaluate();
 
+    /**
+    * Selects the numeric type evaluate() computes in: "float", "double"
+    * (the default), "long-double", "int64" or "decimal" (fixed-point with
+    * four decimal places). Returns false if the name is not recognized.
+    */
+    bool set_numeric_type(const string&);
+
+    /**
+    * Replaces count characters at position pos of the last converted
+    * expression with text and converts the edited expression.
+    *
+    * Conversion state is checkpointed before every token, so only the tokens
+    * from the edit onward are processed again. Returns the postfix
+    * expression, which stays valid until the next conversion.
+    *
+    * An expression that is still being typed may not be valid yet (such as
+    * "3." on the way to "3.5"). Conversion then stops before the first token
+    * that can't be converted, and invalid_token_offset() tells where that is,
+    * until a later edit makes the expression valid again.
+    */
+    const string& convert_edit(size_t pos, size_t count, const string& text);
+
+    /**
+    * Returns the offset of the first token of the expression that couldn't be
+    * converted by the last convert_edit(), or string::npos if every token was.
+    */
+    size_t invalid_token_offset();
+
+    /**
+    * Converts and evaluates every line of a bulk input stream, writing one
+    * evaluation per line to the output stream.
+    *
+    * Token and line boundaries are located by a vectorized pre-pass over
+    * large blocks of the input rather than one byte at a time.
+    */
+    void convert_batch(istream&, ostream&);
+
+    /**
+    * A batch job over the lines [first_line, end_line) of an input file.
+    * Several processes can each take a disjoint range of the same file.
+    */
+    struct BatchJob {
+      string input;           // file to read expressions from
+      string output;          // file to write evaluations to ("" for stdout)
+      uint64_t first_line;    // first line to convert, counting from 0
+      uint64_t end_line;      // line to stop before
+      bool resume;            // continue from the output file's checkpoint
+
+      BatchJob() : first_line(0), end_line(UINT64_MAX), resume(false) {}
+    };
+
+    /**
+    * Converts a range of lines of an input file the way convert_batch()
+    * converts a stream.
+    *
+    * The start of the range is found through a sparse line-offset index
+    * kept in "<input>.idx", so only the first job to need it scans the file.
+    * With an output file, progress is checkpointed atomically to
+    * "<output>.ckpt" after every chunk, and a resumed job skips the lines
+    * that were already written.
+    */
+    void convert_file(const BatchJob&);
+
+    /**
+    * Defines or redefines a sheet formula from an assignment such as
+    * "x = ( 5 + 3 ) * 12". Formulas may refer to each other by name.
+    *
+    * The formula is converted right away but only evaluated by the next
+    * recalculate(). An assignment without a proper name is reported on
+    * stderr and skipped.
+    */
+    void set_formula(const string& assignment);
+
+    /**
+    * Evaluates every formula set since the last call, along with every
+    * formula that depends on one of them, and writes "name = value" for each
+    * in order of definition.
+    *
+    * Formulas are evaluated in dependency order, in waves of formulas that
+    * don't depend on each other, and large waves are split across threads.
+    * Formulas that can't be evaluated, or are on a cycle, show "Error: "
+    * and the reason as their value, and so do the formulas that use them.
+    */
+    void recalculate(ostream&);
+
+    /**
+    * Measures the throughput (in GB/s) of each tokenizer pre-pass available
+    * on this CPU, and of batch conversion as a whole, and prints the results.
+    */
+    void benchmark_tokenizer(ostream&);
+
+    /**
+    * Simulates typing a long expression one keystroke at a time and compares
+    * the cost per keystroke of convert_edit() against a full convert().
+    */
+    void benchmark_incremental(ostream&);
+
+    /**
+    * Measures evaluation speed of a long numerical expression in each
+    * supported numeric type.
+    */
+    void benchmark_numeric(ostream&);
+
+    /**
+    * Returns the name of every variable used so far, in order of first use.
+    * Only accepted expressions count: every line of a batch, every
+    * expression convert() accepts, every formula set without an error, and
+    * an expression edited with convert_edit() as it was left, if valid.
+    */
+    vector<string> variables();
+
+    /**
+    * Starts recording the shape of every expression converted by convert()
+    * or convert_batch(): its size, nesting depth, peak stack depths and mix
+    * of variables and numbers.
+    */
+    void start_profiling();
+
+    /**
+    * Writes the distributions recorded since start_profiling() to a small
+    * text profile file.
+    */
+    void save_profile(const string& path);
+
+    /**
+    * Reads a profile written by save_profile() and sizes the module's working
+    * buffers and batch chunk size for the workload it describes.
+    */
+    void load_profile(const string& path);
+
+#ifdef IN2POST_TRACE_ALLOC
+    /**
+    * Prints the allocations made while converting and evaluating each
+    * expression: the top expressions by bytes allocated and a histogram of
+    * bytes allocated per expression. Only available in trace builds.
+    */
+    void print_allocation_report(ostream&, int top);
+#endif
+
   } // end of namespace in2post
 
 } // end of namespace cop4530
@@ -102,14 +260,193 @@ void in2post_program_loop() {
   }
 }
 
+/**
+* Sheet program loop.
+*
+* Reads "name = expression" formulas, one per line, where later formulas may
+* refer to earlier ones by name and a repeated name redefines a formula. The
+* sheet is recalculated at every blank line, at the end of input, and after
+* every line when input is typed in, and only the formulas affected by the
+* lines since the last recalculation are evaluated and printed.
+*/
+void sheet_program_loop() {
+  string line;          // string to hold current formula we're reading in
+  bool interactive = !input_redirected();
+
+  while (getline(cin, line) && line != "quit") {
+    if (!line.empty()) {
+      in2post::set_formula(line);
+    }
+
+    if (line.empty() || interactive) {
+      in2post::recalculate(cout);
+    }
+  }
+
+  in2post::recalculate(cout);
+}
+
+/**
+* Prints the supported command line options.
+*/
+void print_usage(const char* program) {
+  cerr << "Usage: " << program << " [--batch | --sheet] [--vars] [--profile-out=FILE] [--profile-in=FILE]" << endl
+       << "       [--numeric=TYPE] [--input=FILE [--output=FILE] [--lines=FIRST-END] [--resume]]" << endl
+       << "       [--bench=NAME]" << endl
+       << "  --batch              convert every line of stdin without prompting" << endl
+       << "  --sheet              evaluate 'name = expression' formulas from stdin" << endl
+       << "  --input=FILE         convert every line of FILE without prompting" << endl
+       << "  --output=FILE        write results to FILE, checkpointing to FILE.ckpt" << endl
+       << "  --lines=FIRST-END    convert only lines FIRST up to END of the input" << endl
+       << "  --resume             continue from the output's checkpoint" << endl
+       << "  --vars               list the variables used once input is exhausted" << endl
+       << "  --profile-out=FILE   write the shape of the converted expressions to FILE" << endl
+       << "  --profile-in=FILE    size working buffers from a profile written earlier" << endl
+       << "  --numeric=TYPE       evaluate in float, double (default), long-double," << endl
+       << "                       int64 or decimal (fixed-point, 4 places)" << endl
+       << "  --bench=tokenize     report tokenizer and batch conversion throughput in GB/s" << endl
+       << "  --bench=incremental  compare incremental and full conversion while typing" << endl
+       << "  --bench=numeric      report evaluation speed in each numeric type" << endl;
+}
+
+/**
+* Prints every variable used by the expressions converted so far.
+*/
+void print_variables(ostream& os) {
+  os << "Variables:";
+  for (const string& name : in2post::variables()) {
+    os << ' ' << name;
+  }
+  os << endl;
+}
+
 //------------------------------------------------------------------------------
 //                             main() method
 //------------------------------------------------------------------------------
 
-int main() {
-  in2post_program_loop();
+// Test drivers include this file for the module's internals and supply their
+// own main()
+#ifndef IN2POST_NO_MAIN
+int main(int argc, char* argv[]) {
+  bool batch = false;   // process stdin in bulk instead of prompting
+  bool vars = false;    // report the variables used once input is exhausted
+  bool sheet = false;   // evaluate stdin as a sheet of formulas
+  string bench;         // name of the benchmark to run, if any
+  string profile_out;   // profile file to write once input is exhausted
+  string profile_in;    // profile file to size buffers from
+#ifdef IN2POST_TRACE_ALLOC
+  int trace_top = 10;   // expressions to list in the allocation report
+#endif
+  in2post::BatchJob job;  // file to convert, if any
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+
+    if (arg == "--batch") {
+      batch = true;
+    }
+    else if (arg == "--sheet") {
+      sheet = true;
+    }
+    else if (arg == "--vars") {
+      vars = true;
+    }
+    else if (arg.compare(0, 14, "--profile-out=") == 0) {
+      profile_out = arg.substr(14);
+    }
+    else if (arg.compare(0, 13, "--profile-in=") == 0) {
+      profile_in = arg.substr(13);
+    }
+    else if (arg.compare(0, 8, "--input=") == 0) {
+      job.input = arg.substr(8);
+    }
+    else if (arg.compare(0, 9, "--output=") == 0) {
+      job.output = arg.substr(9);
+    }
+    else if (arg.compare(0, 8, "--lines=") == 0) {
+      string range = arg.substr(8);
+      size_t dash = range.find('-');
+
+      job.first_line = strtoull(range.c_str(), nullptr, 10);
+      if (dash != string::npos && dash + 1 < range.size()) {
+        job.end_line = strtoull(range.c_str() + dash + 1, nullptr, 10);
+      }
+    }
+    else if (arg == "--resume") {
+      job.resume = true;
+    }
+#ifdef IN2POST_TRACE_ALLOC
+    else if (arg.compare(0, 12, "--trace-top=") == 0) {
+      trace_top = atoi(arg.c_str() + 12);
+    }
+#endif
+    else if (arg.compare(0, 10, "--numeric=") == 0) {
+      if (!in2post::set_numeric_type(arg.substr(10))) {
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+      }
+    }
+    else if (arg.compare(0, 8, "--bench=") == 0) {
+      bench = arg.substr(8);
+    }
+    else {
+      print_usage(argv[0]);
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (!profile_in.empty()) {
+    in2post::load_profile(profile_in);
+  }
+  if (!profile_out.empty()) {
+    in2post::start_profiling();
+  }
+
+  if (bench == "tokenize") {
+    in2post::benchmark_tokenizer(cout);
+  }
+  else if (bench == "incremental") {
+    in2post::benchmark_incremental(cout);
+  }
+  else if (bench == "numeric") {
+    in2post::benchmark_numeric(cout);
+  }
+  else if (!bench.empty()) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  else if (!job.input.empty()) {
+    in2post::convert_file(job);
+  }
+  else if (!job.output.empty() || job.resume || job.first_line != 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+  else if (sheet) {
+    sheet_program_loop();
+  }
+  else if (batch) {
+    in2post::convert_batch(cin, cout);
+  }
+  else {
+    in2post_program_loop();
+  }
+
+  if (vars) {
+    print_variables(cerr);
+  }
+
+  if (!profile_out.empty()) {
+    in2post::save_profile(profile_out);
+  }
+
+#ifdef IN2POST_TRACE_ALLOC
+  in2post::print_allocation_report(cerr, trace_top);
+#endif
+
   return 0;
 }
+#endif
 
 
 //------------------------------------------------------------------------------
@@ -134,10 +471,21 @@ namespace cop4530 {
     */
     namespace error {
       enum ErrorCode {
+        ERR_NONE,         // not an error: the step that returned it succeeded
         ERR_DEFAULT,
         ERR_INVALID_TOKEN,
         ERR_INVALID_OPERATION,
-        ERR_INVALID_OPERAND
+        ERR_INVALID_OPERAND,
+        ERR_INVALID_EDIT,
+        ERR_DIVISION_BY_ZERO,
+        ERR_OVERFLOW,
+        ERR_PROFILE_IO,
+        ERR_FILE_IO,
+        ERR_CHECKPOINT_MISMATCH,
+        ERR_INDEX_NOT_SAVED,
+        ERR_INVALID_ASSIGNMENT,
+        ERR_CIRCULAR_REFERENCE,
+        ERR_INCOMPLETE_EXPRESSION
       };
 
       // Encapsulates ae error into a standard format consisting of a code and a
@@ -158,7 +506,17 @@ namespace cop4530 {
         Error(ERR_DEFAULT, "An error with the in2post module occured."),
         Error(ERR_INVALID_TOKEN, "Expression contains invalid token."),
         Error(ERR_INVALID_OPERATION, "Supplied operation is not supported."),
-        Error(ERR_INVALID_OPERAND, "Operand must be a numerical value or proper identifier.")
+        Error(ERR_INVALID_OPERAND, "Operand must be a numerical value or proper identifier."),
+        Error(ERR_INVALID_EDIT, "Edit position is outside the expression."),
+        Error(ERR_DIVISION_BY_ZERO, "Integer or decimal division by zero."),
+        Error(ERR_OVERFLOW, "Number or result is outside the range of the numeric type."),
+        Error(ERR_PROFILE_IO, "Unable to read or write the workload profile."),
+        Error(ERR_FILE_IO, "Unable to read or write a batch file."),
+        Error(ERR_CHECKPOINT_MISMATCH, "Checkpoint is missing or does not match this batch job."),
+        Error(ERR_INDEX_NOT_SAVED, "Unable to save the line index, so it is kept for this job only."),
+        Error(ERR_INVALID_ASSIGNMENT, "Sheet formulas must have the form 'name = expression'."),
+        Error(ERR_CIRCULAR_REFERENCE, "Formula is part of or depends on a circular reference."),
+        Error(ERR_INCOMPLETE_EXPRESSION, "Expression is missing an operand, an operation or a ')'.")
       };
 
       // Reference to default error for ease of use.
@@ -178,291 +536,2438 @@ namespace cop4530 {
         return DEFAULT_ERROR;
       }
 
+      /**
+      * Outputs the error to the console without exiting, for input the
+      * program can skip and carry on after.
+      */
+      void report_error(ErrorCode ec) {
+        cerr << "\nError: " << get_error(ec).message << endl;
+      }
+
       /**
       * "Throws" an error by outputing the error to the console and exiting the
       * program with a non-successful status code.
       */
       void throw_error(ErrorCode ec) {
-        cerr << "\nError: " << get_error(ec).message << endl;
+        report_error(ec);
         exit(EXIT_FAILURE);
       }
 
     }   // end of namespace error
 
+    //--------------------------------------------------------------------------
+    //                      in2post symbol interning
+    //--------------------------------------------------------------------------
+
     /**
-    * This anonymous namespace encapsulates private functionality to the in2post
-    * module that we don't want exposed to the user.
+    * Namespace cop4530::in2post::symbols
+    *
+    * Interning table for variable names. Each distinct name is stored once in
+    * a shared string pool and referred to everywhere else by a small integer
+    * id, so a batch using a few hundred names over millions of expressions
+    * keeps only a few hundred strings.
     */
-    namespace {
-
-      //------------------------------------------------------------------------
-      //                       Internal data members
-      //------------------------------------------------------------------------
-
-      // Stack for holding operators while converting
-      Stack<string> operator_stack;
-
-      // Stack for holding operands when evaluating postfix expression
-      // Expressions with variable operands are never evaluated, so this holds
-      // only a numeric value.
-      Stack<double> operand_stack;
-
-      bool has_vars;    // becomes true if expression contains variable operands
-
-      string expression;                // string to hold expression we are converting
-      vector<string> postfix_tokens;    // vector holding postfix expression's ops
-
-
-      //------------------------------------------------------------------------
-      //                 Internal (private) module methods
-      //------------------------------------------------------------------------
+    namespace symbols {
+      string pool;                // every interned name, back to back
+      vector<uint32_t> offsets;   // start of name i in the pool is offsets[i]
+      vector<uint32_t> slots;     // open-addressed hash table of (id + 1)
 
       /**
-      * Applies specified operation to the two numerical values supplied.
-      * Throws an error if operation is invalid.
+      * FNV-1a hash of a name.
       */
-      double apply_operation(const string& operation, double lhs, double rhs) {
-        if (operation == "*") {
-          return lhs * rhs;
-        }
-        else if (operation == "/") {
-          return lhs / rhs;
-        }
-        else if (operation == "+") {
-          return lhs + rhs;
-        }
-        else if (operation == "-") {
-          return lhs - rhs;
+      uint32_t hash(const char* name, size_t length) {
+        uint32_t h = 2166136261u;
+        for (size_t i = 0; i < length; i++) {
+          h = (h ^ static_cast<unsigned char>(name[i])) * 16777619u;
         }
 
-        error::throw_error(error::ERR_INVALID_OPERATION);
-        return 0.0;
+        return h;
       }
 
       /**
-      * Returns a stringified representation of the postfix expression.
-      *
-      * NOTE: An ending space is output with the current logic.
-      * TODO: Possibly fix the above note, removing the trailing space.
+      * Returns the number of interned names.
       */
-      string postfix_expression() {
-        string postfix_exp = "";
-
-        // Generate string of postfix expression
-        for (string& item : postfix_tokens) {
-          postfix_exp += item + " ";
-        }
-
-        return postfix_exp;
+      uint32_t count() {
+        return offsets.empty() ? 0 : offsets.size() - 1;
       }
 
-
       /**
-      * Returns true if token is a valid number or variable operand.
-      * Additionally sets a flag if it is a variable so we don't try to evaluate the
-      * expression later on.
+      * Returns the length of the name with the given id.
       */
-      bool is_operand(const string& token) {
-        regex match_num = regex("[0-9]+(\\.?[0-9]+)?");
-        regex match_var = regex("[a-zA-Z]+[0-9a-zA-Z_]*");
-
-        // First check to see if token is a variable, because we need to flag this so
-        // we don't try to evaluate the expression later on
-        if (regex_match(token, match_var)) {
-          has_vars = true;
-          return true;
-        }
-
-        // Otherwise return whether it's a num or not
-        return regex_match(token, match_num);
+      size_t length(uint32_t id) {
+        return offsets[id + 1] - offsets[id];
       }
 
       /**
-      * Returns true if the supplied token is a valid operation as defined by
-      * a regular expression.
+      * Returns the name with the given id.
       */
-      bool is_operation(const string& token) {
-        regex match_oper = regex("[\\+\\-\\*\\/]{1}");
-
-        return regex_match(token, match_oper);
+      string name(uint32_t id) {
+        return pool.substr(offsets[id], length(id));
       }
 
       /**
-      * Evaluate a numerical expression (i.e. one without variable identifiers)
-      * from a set of input tokens.
-      *
-      * Utilizes a stack to store results of all the latest subexpression
-      * calculated, until eventually only 1 element in the operand stack remains
-      * (i.e. the final value of the expression).
-      * TODO: If invalid tokens are found, throw an error.
+      * Returns the slot that holds the name, or the empty slot where it
+      * belongs if it hasn't been interned yet.
       */
-      void evaluate_numerical_expression() {
-        for (string& item : postfix_tokens) {
-          if (is_operand(item)) {
-            operand_stack.push(stod(item));
-          }
-          else if (is_operation(item)) {
-            double rhs = operand_stack.top();
-            operand_stack.pop();
-            double lhs = operand_stack.top();
-            operand_stack.pop();
+      size_t find_slot(const char* name, size_t len) {
+        size_t mask = slots.size() - 1;
+        size_t slot = hash(name, len) & mask;
 
-            operand_stack.push(apply_operation(item, lhs, rhs));
+        while (slots[slot] != 0) {
+          uint32_t id = slots[slot] - 1;
+          if (length(id) == len && pool.compare(offsets[id], len, name, len) == 0) {
+            break;
           }
+          slot = (slot + 1) & mask;
         }
-      }
 
-      /**
-      * Add operand to postfix token list.
-      */
-      void process_operand(const string& oper) {
-        postfix_tokens.push_back(oper);
+        return slot;
       }
 
       /**
-      * Adds proper postfix tokens when current input token is an operation
-      * based on the algorithm specified in the project description &
-      * requirements document.
+      * Replaces the hash table with one of the given power of two size and
+      * reinserts every interned name.
       */
-      void process_operation(const string& oper) {
-        // Push stack to postfix expression until the following conditions are
-        // met
-        while (!operator_stack.empty()) {
-          const string& current = operator_stack.top();
-          if (current != "(") {
-            if (oper == "*" || oper == "/") {
-              if (current != "+" && current != "-") {
-                postfix_tokens.push_back(current);
-                operator_stack.pop();
-              }
-              else {
-                break;
-              }
-            }
-            else {
-              postfix_tokens.push_back(current);
-              operator_stack.pop();
-            }
-          }
-          else {
-            break;
-          }
-        }
+      void rehash(size_t size) {
+        vector<uint32_t> new_slots(size, 0);
+        slots.swap(new_slots);
 
-        operator_stack.push(oper);
+        for (uint32_t id = 0; id < count(); id++) {
+          slots[find_slot(&pool[offsets[id]], length(id))] = id + 1;
+        }
       }
 
       /**
-      * Append a group-opening character to the operator stack.
+      * Doubles the hash table.
       */
-      void process_group_opened() {
-        operator_stack.push("(");
+      void grow() {
+        rehash(slots.empty() ? 64 : slots.size() * 2);
       }
 
       /**
-      * Adds all the operators in the current group to the postfix token list.
+      * Sizes the table and string pool for n names, so interning that many
+      * never has to grow them.
       */
-      void process_group_closed() {
-        // Push operators until beginning of group (i.e. a '(') is found.
-        while (operator_stack.top() != "(") {
-          postfix_tokens.push_back(operator_stack.top());
-          operator_stack.pop();
+      void reserve(uint32_t n) {
+        size_t size = 64;
+        while (size < size_t(n) * 2) {
+          size *= 2;
         }
 
-        // Remove the '('
-        operator_stack.pop();
-      }
-
-      /**
-      * Returns a vector of the tokens of an infix expression.
-      * Token is defined to be a space-separated string.
-      */
-      vector<string> tokenize_infix_expression() {
-        istringstream iss(expression);
-        vector<string> infix_tokens;
-        string token;
-
-        while (getline(iss, token, ' ')) {
-          infix_tokens.push_back(token);
+        if (size > slots.size()) {
+          rehash(size);
         }
-
-        return infix_tokens;
+        pool.reserve(size_t(n) * 8);
+        offsets.reserve(n + 1);
       }
 
       /**
-      * Cleanup method to reset the module state when working with a new
-      * expression to convert. Only needs to be called in the convert() method,
-      * as repeated calls to evaluate() should return the same result (cached
-      * from the initial call).
+      * Returns the id of a name, interning it first if it is new.
       */
-      void reset() {
-        postfix_tokens.clear();
-        operand_stack.clear();
-        operator_stack.clear();
-        expression = "";
-        has_vars = false;
-      }
+      uint32_t intern(const char* name, size_t len) {
+        // Keep the table at most half full so probe sequences stay short
+        if ((count() + 1) * 2 > slots.size()) {
+          grow();
+        }
 
-      /**
-      * Runs through every token in an infix expression string and generates a
-      * postfix expression as a list of tokens.
-      */
-      void process_infix_tokens(const vector<string>& infix_tokens) {
-        // Loop through each token from the infix expression and process it
-        // according to what kind of token it is.
-        for (const string& token : infix_tokens) {
-          // Match numbers and variables
-          if (is_operand(token)) {
-            process_operand(token);
-          }
-          // Match beginning of a group
-          else if (token == "(") {
-            process_group_opened();
-          }
-          // Match operators
-          else if (is_operation(token)) {
-            process_operation(token);
-          }
-          // Match closing of a group
-          else if (token == ")") {
-            process_group_closed();
+        size_t slot = find_slot(name, len);
+        if (slots[slot] == 0) {
+          if (offsets.empty()) {
+            offsets.push_back(0);
           }
-          // We've received an invalid token, so we should throw an error.
-          else {
-            error::throw_error(error::ERR_INVALID_TOKEN);
-          }
-        }
 
-        // Almost finished. Add the remaining operations from the operator stack.
-        while (!operator_stack.empty()) {
-          postfix_tokens.push_back(operator_stack.top());
-          operator_stack.pop();
+          pool.append(name, len);
+          offsets.push_back(pool.size());
+          slots[slot] = count();
         }
-      }
 
-    }   // end of anonymous namespace
+        return slots[slot] - 1;
+      }
 
+      uint32_t intern(const string& name) {
+        return intern(name.data(), name.size());
+      }
 
-    //--------------------------------------------------------------------------
-    //               Module in2post public interace definitions
-    //--------------------------------------------------------------------------
+    }   // end of namespace symbols
 
     /**
-    * Convert the expression supplied as an argument to a postfix expression.
+    * This anonymous namespace encapsulates private functionality to the in2post
+    * module that we don't want exposed to the user.
+    */
+    namespace {
+
+      //------------------------------------------------------------------------
+      //                       Internal data members
+      //------------------------------------------------------------------------
+
+      // Stack for holding operators while converting
+      Stack<string> operator_stack;
+
+      bool has_vars;    // becomes true if expression contains variable operands
+      int open_groups;  // groups opened and not yet closed
+
+      int peak_operator_depth = 0;      // deepest the operator stack has been
+      int reserved_operand_depth = 0;   // operand stack room to reserve when evaluating
+
+      enum TokenKind {
+        TOKEN_NUMBER,
+        TOKEN_VARIABLE,
+        TOKEN_OPERATION
+      };
+
+      /**
+      * A postfix token. Only numbers keep their text, which lives in the
+      * per-expression number_text buffer; variables are interned symbols and
+      * operations are a single character.
+      */
+      struct PostfixToken {
+        TokenKind kind;
+        uint32_t value;   // number_text offset, symbol id, or operation char
+      };
+
+      string expression;                  // string to hold expression we are converting
+      vector<PostfixToken> postfix_tokens;  // vector holding postfix expression's ops
+      string number_text;                 // NUL-terminated text of each number token
+      string postfix_text;                // rendering of the postfix expression
+      vector<size_t> rendered_ends;       // end of each rendered token in postfix_text
+
+      /**
+      * Module state saved before each infix token is processed, so that
+      * conversion can restart from any token without redoing those before it.
+      */
+      struct TokenCheckpoint {
+        size_t postfix_size;        // postfix_tokens.size() before the token
+        size_t number_text_size;    // number_text.size() before the token
+        bool has_vars;              // has_vars before the token
+        int open_groups;            // open_groups before the token
+      };
+
+      vector<string> expression_tokens;     // infix tokens of the expression
+      vector<size_t> token_offsets;         // offset of each infix token
+      vector<TokenCheckpoint> checkpoints;  // checkpoint before each infix token
+      size_t flush_start = 0;               // postfix_tokens.size() before the final flush
+      size_t invalid_offset = string::npos; // offset of the token conversion stopped at
+      bool editing = false;                 // expression was last changed by convert_edit()
+
+      // Variables of accepted expressions. Conversion interns every name it
+      // meets, including those of rejected expressions and of each partial
+      // identifier typed during an edit, so the symbol table can't tell which
+      // were really used.
+      vector<char> variable_used;       // whether each symbol has been used
+      vector<uint32_t> used_variables;  // symbols used, in order of first use
+
+
+      //------------------------------------------------------------------------
+      //                     Numeric types for evaluation
+      //------------------------------------------------------------------------
+
+      enum NumericType {
+        NUMERIC_FLOAT,
+        NUMERIC_DOUBLE,
+        NUMERIC_LONG_DOUBLE,
+        NUMERIC_INT64,
+        NUMERIC_DECIMAL
+      };
+
+      // Name of each numeric type as accepted by set_numeric_type()
+      const struct {
+        NumericType type;
+        const char* name;
+      } numeric_type_names[] = {
+        { NUMERIC_FLOAT, "float" },
+        { NUMERIC_DOUBLE, "double" },
+        { NUMERIC_LONG_DOUBLE, "long-double" },
+        { NUMERIC_INT64, "int64" },
+        { NUMERIC_DECIMAL, "decimal" }
+      };
+
+      NumericType numeric_type = NUMERIC_DOUBLE;  // type used by evaluate()
+
+      // Number of digits kept after the decimal point by Decimal
+      const int DECIMAL_PLACES = 4;
+      const int64_t DECIMAL_SCALE = 10000;
+
+      /**
+      * Fixed-point decimal number stored as a count of 1/DECIMAL_SCALE units,
+      * so sums and differences of money amounts are exact. Products and
+      * quotients are rounded half away from zero to the nearest unit.
+      */
+      struct Decimal {
+        int64_t units;
+      };
+
+      /**
+      * Divides a 128-bit value, rounding half away from zero, and stores the
+      * quotient in result. Returns ERR_OVERFLOW if it doesn't fit in 64 bits.
+      */
+      error::ErrorCode divide_rounded(__int128 num, __int128 den, int64_t& result) {
+        __int128 quotient = num / den;
+        __int128 remainder = num % den;
+
+        if (remainder < 0) {
+          remainder = -remainder;
+        }
+        if (remainder * 2 >= (den < 0 ? -den : den)) {
+          quotient += (num < 0) == (den < 0) ? 1 : -1;
+        }
+
+        if (quotient > INT64_MAX || quotient < INT64_MIN) {
+          return error::ERR_OVERFLOW;
+        }
+
+        result = static_cast<int64_t>(quotient);
+        return error::ERR_NONE;
+      }
+
+      /**
+      * Parses number token text into the given numeric type, storing it in
+      * value. Decimals round to DECIMAL_PLACES digits.
+      *
+      * Returns ERR_OVERFLOW if an integer or decimal doesn't fit in its type,
+      * and ERR_INVALID_OPERAND if an integer has a fractional part other than
+      * 0's. Floating point types parse out of range numbers as infinity.
+      */
+      template <typename Number>
+      error::ErrorCode parse_number(const char* text, Number& value);
+
+      template <>
+      error::ErrorCode parse_number<float>(const char* text, float& value) {
+        value = strtof(text, nullptr);
+        return error::ERR_NONE;
+      }
+
+      template <>
+      error::ErrorCode parse_number<double>(const char* text, double& value) {
+        value = strtod(text, nullptr);
+        return error::ERR_NONE;
+      }
+
+      template <>
+      error::ErrorCode parse_number<long double>(const char* text, long double& value) {
+        value = strtold(text, nullptr);
+        return error::ERR_NONE;
+      }
+
+      template <>
+      error::ErrorCode parse_number<int64_t>(const char* text, int64_t& value) {
+        char* end;
+        errno = 0;
+        value = strtoll(text, &end, 10);
+
+        if (errno == ERANGE) {
+          return error::ERR_OVERFLOW;
+        }
+
+        // "3.0" is a whole number, but "3.5" would have to be truncated
+        if (*end == '.') {
+          for (end++; *end == '0'; end++) {
+          }
+          if (*end >= '1' && *end <= '9') {
+            return error::ERR_INVALID_OPERAND;
+          }
+        }
+
+        return error::ERR_NONE;
+      }
+
+      template <>
+      error::ErrorCode parse_number<Decimal>(const char* text, Decimal& value) {
+        int64_t units = 0;
+        int64_t fraction = 0;
+
+        for (; *text >= '0' && *text <= '9'; text++) {
+          if (__builtin_mul_overflow(units, 10, &units)
+              || __builtin_add_overflow(units, *text - '0', &units)) {
+            return error::ERR_OVERFLOW;
+          }
+        }
+
+        if (*text == '.') {
+          text++;
+
+          int64_t place = DECIMAL_SCALE / 10;
+          for (; *text >= '0' && *text <= '9' && place > 0; text++) {
+            fraction += (*text - '0') * place;
+            place /= 10;
+          }
+
+          // Round on the first digit that doesn't fit
+          if (*text >= '5' && *text <= '9') {
+            fraction++;
+          }
+        }
+
+        if (__builtin_mul_overflow(units, DECIMAL_SCALE, &units)
+            || __builtin_add_overflow(units, fraction, &value.units)) {
+          return error::ERR_OVERFLOW;
+        }
+
+        return error::ERR_NONE;
+      }
+
+      /**
+      * Formats a double result to six decimal places, removing trailing 0's
+      * and the '.' if there are no decimals, as the module always has.
+      */
+      template <typename Number>
+      string format_number(Number value) {
+        string eval = to_string(value);
+
+        // Formatting to remove trailing 0's
+        while (eval.back() == '0') {
+          eval.pop_back();
+        }
+
+        // Remove . if no decimals
+        if (eval.back() == '.') {
+          eval.pop_back();
+        }
+
+        return eval;
+      }
+
+      /**
+      * Formats a float or long double result to the significant digits its
+      * type holds, so float shows no noise digits and long double shows the
+      * precision double lacks. %g drops trailing 0's itself.
+      */
+      string format_number(float value) {
+        char eval[32];
+        snprintf(eval, sizeof(eval), "%.*g", numeric_limits<float>::digits10, value);
+        return eval;
+      }
+
+      string format_number(long double value) {
+        char eval[64];
+        snprintf(eval, sizeof(eval), "%.*Lg", numeric_limits<long double>::digits10, value);
+        return eval;
+      }
+
+      string format_number(int64_t value) {
+        return to_string(value);
+      }
+
+      string format_number(Decimal value) {
+        // Work with the magnitude as unsigned so the most negative value is safe
+        uint64_t magnitude = value.units < 0 ? 0 - uint64_t(value.units) : value.units;
+        string fraction = to_string(magnitude % DECIMAL_SCALE);
+        string eval = (value.units < 0 ? "-" : "") + to_string(magnitude / DECIMAL_SCALE);
+
+        fraction.insert(0, DECIMAL_PLACES - fraction.size(), '0');
+        while (!fraction.empty() && fraction.back() == '0') {
+          fraction.pop_back();
+        }
+
+        if (!fraction.empty()) {
+          eval += "." + fraction;
+        }
+
+        return eval;
+      }
+
+
+      //------------------------------------------------------------------------
+      //                 Internal (private) module methods
+      //------------------------------------------------------------------------
+
+      /**
+      * Applies specified operation to the two numerical values supplied,
+      * storing the result. Returns ERR_NONE, or the error that kept the
+      * result from being computed.
+      *
+      * Floating point types overflow to infinity, so for them only an invalid
+      * operation is an error.
+      */
+      template <typename Number>
+      error::ErrorCode apply_operation(char operation, Number lhs, Number rhs, Number& result) {
+        if (operation == '*') {
+          result = lhs * rhs;
+        }
+        else if (operation == '/') {
+          result = lhs / rhs;
+        }
+        else if (operation == '+') {
+          result = lhs + rhs;
+        }
+        else if (operation == '-') {
+          result = lhs - rhs;
+        }
+        else {
+          return error::ERR_INVALID_OPERATION;
+        }
+
+        return error::ERR_NONE;
+      }
+
+      /**
+      * Integer arithmetic is checked for overflow, and division truncates
+      * toward zero.
+      */
+      error::ErrorCode apply_operation(char operation, int64_t lhs, int64_t rhs, int64_t& result) {
+        bool overflow;
+
+        if (operation == '*') {
+          overflow = __builtin_mul_overflow(lhs, rhs, &result);
+        }
+        else if (operation == '/') {
+          if (rhs == 0) {
+            return error::ERR_DIVISION_BY_ZERO;
+          }
+
+          overflow = lhs == INT64_MIN && rhs == -1;
+          result = overflow ? 0 : lhs / rhs;
+        }
+        else if (operation == '+') {
+          overflow = __builtin_add_overflow(lhs, rhs, &result);
+        }
+        else if (operation == '-') {
+          overflow = __builtin_sub_overflow(lhs, rhs, &result);
+        }
+        else {
+          return error::ERR_INVALID_OPERATION;
+        }
+
+        return overflow ? error::ERR_OVERFLOW : error::ERR_NONE;
+      }
+
+      /**
+      * Decimal arithmetic is checked for overflow. Products and quotients are
+      * worked out in 128 bits and rounded to the nearest unit.
+      */
+      error::ErrorCode apply_operation(char operation, Decimal lhs, Decimal rhs, Decimal& result) {
+        if (operation == '*') {
+          return divide_rounded(__int128(lhs.units) * rhs.units, DECIMAL_SCALE, result.units);
+        }
+        else if (operation == '/') {
+          if (rhs.units == 0) {
+            return error::ERR_DIVISION_BY_ZERO;
+          }
+
+          return divide_rounded(__int128(lhs.units) * DECIMAL_SCALE, rhs.units, result.units);
+        }
+        else if (operation == '+') {
+          if (__builtin_add_overflow(lhs.units, rhs.units, &result.units)) {
+            return error::ERR_OVERFLOW;
+          }
+        }
+        else if (operation == '-') {
+          if (__builtin_sub_overflow(lhs.units, rhs.units, &result.units)) {
+            return error::ERR_OVERFLOW;
+          }
+        }
+        else {
+          return error::ERR_INVALID_OPERATION;
+        }
+
+        return error::ERR_NONE;
+      }
+
+      /**
+      * Returns a stringified representation of the postfix expression.
+      *
+      * The string is built up in postfix_text, and only tokens added since the
+      * last call are rendered.
+      *
+      * NOTE: An ending space is output with the current logic.
+      * TODO: Possibly fix the above note, removing the trailing space.
+      */
+      const string& postfix_expression() {
+        // Generate string of postfix expression
+        for (size_t i = rendered_ends.size(); i < postfix_tokens.size(); i++) {
+          const PostfixToken& item = postfix_tokens[i];
+
+          if (item.kind == TOKEN_NUMBER) {
+            postfix_text += &number_text[item.value];
+          }
+          else if (item.kind == TOKEN_VARIABLE) {
+            postfix_text.append(symbols::pool, symbols::offsets[item.value],
+                                symbols::length(item.value));
+          }
+          else {
+            postfix_text += static_cast<char>(item.value);
+          }
+
+          postfix_text += " ";
+          rendered_ends.push_back(postfix_text.size());
+        }
+
+        return postfix_text;
+      }
+
+      /**
+      * Discards the rendering of every postfix token from index size onward.
+      */
+      void truncate_rendering(size_t size) {
+        if (rendered_ends.size() > size) {
+          rendered_ends.resize(size);
+          postfix_text.resize(size > 0 ? rendered_ends.back() : 0);
+        }
+      }
+
+
+      /**
+      * Returns true if token is a valid variable identifier.
+      */
+      bool is_variable(const string& token) {
+        static const regex match_var = regex("[a-zA-Z]+[0-9a-zA-Z_]*");
+
+        return regex_match(token, match_var);
+      }
+
+      /**
+      * Returns true if token is a valid integer or real number.
+      */
+      bool is_number(const string& token) {
+        static const regex match_num = regex("[0-9]+(\\.?[0-9]+)?");
+
+        return regex_match(token, match_num);
+      }
+
+      /**
+      * Returns true if the supplied token is a valid operation as defined by
+      * a regular expression.
+      */
+      bool is_operation(const string& token) {
+        static const regex match_oper = regex("[\\+\\-\\*\\/]{1}");
+
+        return regex_match(token, match_oper);
+      }
+
+      /**
+      * Kinds of infix token. The batch path works them out from the tokenizer
+      * pre-pass; everything else matches the token against the regular
+      * expressions above.
+      */
+      enum InfixKind : uint8_t {
+        INFIX_VARIABLE,
+        INFIX_NUMBER,
+        INFIX_OPERATION,
+        INFIX_GROUP_OPENED,
+        INFIX_GROUP_CLOSED,
+        INFIX_INVALID
+      };
+
+      /**
+      * Returns the kind of an infix token.
+      */
+      InfixKind classify_infix_token(const string& token) {
+        if (is_variable(token)) {
+          return INFIX_VARIABLE;
+        }
+        else if (is_number(token)) {
+          return INFIX_NUMBER;
+        }
+        else if (token == "(") {
+          return INFIX_GROUP_OPENED;
+        }
+        else if (is_operation(token)) {
+          return INFIX_OPERATION;
+        }
+        else if (token == ")") {
+          return INFIX_GROUP_CLOSED;
+        }
+
+        return INFIX_INVALID;
+      }
+
+      /**
+      * Parses every number operand of a postfix expression, in order, into
+      * numbers. Returns the first parse error, if any, for the caller to
+      * report.
+      */
+      template <typename Number>
+      error::ErrorCode parse_numbers(const vector<PostfixToken>& postfix, const string& text,
+                                     vector<Number>& numbers) {
+        numbers.clear();
+
+        for (const PostfixToken& item : postfix) {
+          if (item.kind == TOKEN_NUMBER) {
+            Number value;
+            error::ErrorCode err = parse_number(&text[item.value], value);
+            if (err != error::ERR_NONE) {
+              return err;
+            }
+
+            numbers.push_back(value);
+          }
+        }
+
+        return error::ERR_NONE;
+      }
+
+      /**
+      * Evaluate a postfix expression whose number operands have already been
+      * parsed in order into numbers, and whose variable operands have been
+      * given values, in order, in variables.
+      *
+      * Utilizes a stack to store results of all the latest subexpression
+      * calculated, until eventually only 1 element in the operand stack remains
+      * (i.e. the final value of the expression), which is stored in result.
+      *
+      * Returns ERR_INCOMPLETE_EXPRESSION if no single value remains, as while
+      * an expression is being typed: an operation is missing an operand or a
+      * group isn't closed. Returns the error of an operation that fails, such
+      * as by overflowing. The caller decides how to report either.
+      */
+      template <typename Number>
+      error::ErrorCode evaluate_parsed_expression(const vector<PostfixToken>& postfix,
+                                                  const vector<Number>& numbers,
+                                                  const vector<Number>& variables,
+                                                  Number& result) {
+        // Stack for holding operands when evaluating postfix expression. Sheet
+        // formulas are evaluated on several threads, so each has its own.
+        static thread_local Stack<Number> operand_stack;
+        operand_stack.clear();
+        operand_stack.reserve(reserved_operand_depth);
+
+        size_t next_number = 0;     // index of the next number operand
+        size_t next_variable = 0;   // index of the next variable operand
+
+        for (const PostfixToken& item : postfix) {
+          if (item.kind == TOKEN_NUMBER) {
+            operand_stack.push(numbers[next_number++]);
+          }
+          else if (item.kind == TOKEN_VARIABLE) {
+            operand_stack.push(variables[next_variable++]);
+          }
+          // An unclosed group leaves its '(' among the postfix operations, and
+          // an operation without two operands leaves nothing to evaluate
+          else if (item.value == '(' || operand_stack.size() < 2) {
+            return error::ERR_INCOMPLETE_EXPRESSION;
+          }
+          else {
+            Number rhs = operand_stack.top();
+            operand_stack.pop();
+            Number lhs = operand_stack.top();
+            operand_stack.pop();
+
+            Number value;
+            error::ErrorCode err = apply_operation(item.value, lhs, rhs, value);
+            if (err != error::ERR_NONE) {
+              return err;
+            }
+
+            operand_stack.push(value);
+          }
+        }
+
+        // If expression is evaluated without errors, then the operand stack will
+        // contain a single element (the final value of the expression).
+        if (operand_stack.size() != 1) {
+          return error::ERR_INCOMPLETE_EXPRESSION;
+        }
+
+        result = operand_stack.top();
+        return error::ERR_NONE;
+      }
+
+      /**
+      * Evaluate a numerical expression (i.e. one without variable identifiers),
+      * parsing its number operands first, and return the result formatted for
+      * its numeric type.
+      *
+      * Returns an empty string for an incomplete expression, and throws any
+      * other error.
+      */
+      template <typename Number>
+      string evaluate_numerical_expression() {
+        static vector<Number> numbers;
+        static const vector<Number> no_variables;
+        Number result;
+
+        error::ErrorCode err = parse_numbers(postfix_tokens, number_text, numbers);
+        if (err == error::ERR_NONE) {
+          err = evaluate_parsed_expression(postfix_tokens, numbers, no_variables, result);
+        }
+
+        if (err == error::ERR_INCOMPLETE_EXPRESSION) {
+          return "";
+        }
+        if (err != error::ERR_NONE) {
+          error::throw_error(err);
+        }
+
+        return format_number(result);
+      }
+
+      /**
+      * Add number operand to postfix token list.
+      */
+      void process_number(const string& oper) {
+        postfix_tokens.push_back({ TOKEN_NUMBER, uint32_t(number_text.size()) });
+        number_text.append(oper.c_str(), oper.size() + 1);
+      }
+
+      /**
+      * Add variable operand to postfix token list as an interned symbol.
+      */
+      void process_variable(const string& oper) {
+        postfix_tokens.push_back({ TOKEN_VARIABLE, symbols::intern(oper) });
+      }
+
+      /**
+      * Add an operation popped off the operator stack to postfix token list.
+      */
+      void push_operation(const string& oper) {
+        postfix_tokens.push_back({ TOKEN_OPERATION, uint32_t(oper[0]) });
+      }
+
+      /**
+      * Adds proper postfix tokens when current input token is an operation
+      * based on the algorithm specified in the project description &
+      * requirements document.
+      */
+      void process_operation(const string& oper) {
+        // Push stack to postfix expression until the following conditions are
+        // met
+        while (!operator_stack.empty()) {
+          const string& current = operator_stack.top();
+          if (current != "(") {
+            if (oper == "*" || oper == "/") {
+              if (current != "+" && current != "-") {
+                push_operation(current);
+                operator_stack.pop();
+              }
+              else {
+                break;
+              }
+            }
+            else {
+              push_operation(current);
+              operator_stack.pop();
+            }
+          }
+          else {
+            break;
+          }
+        }
+
+        operator_stack.push(oper);
+      }
+
+      /**
+      * Append a group-opening character to the operator stack.
+      */
+      void process_group_opened() {
+        operator_stack.push("(");
+        open_groups++;
+      }
+
+      /**
+      * Adds all the operators in the current group to the postfix token list.
+      */
+      void process_group_closed() {
+        // Push operators until beginning of group (i.e. a '(') is found.
+        while (operator_stack.top() != "(") {
+          push_operation(operator_stack.top());
+          operator_stack.pop();
+        }
+
+        // Remove the '('
+        operator_stack.pop();
+        open_groups--;
+      }
+
+      /**
+      * Appends the tokens of the infix expression from offset start onward to
+      * expression_tokens, and the offset of each to token_offsets.
+      * Token is defined to be a space-separated string, and start must be
+      * the beginning of a token.
+      */
+      void tokenize_infix_expression(size_t start) {
+        size_t token_start = start;
+
+        while (token_start < expression.size()) {
+          size_t token_end = expression.find(' ', token_start);
+          if (token_end == string::npos) {
+            token_end = expression.size();
+          }
+
+          expression_tokens.push_back(expression.substr(token_start, token_end - token_start));
+          token_offsets.push_back(token_start);
+          token_start = token_end + 1;
+        }
+      }
+
+      /**
+      * Marks the variables of the converted expression as used, once the
+      * expression has been accepted.
+      */
+      void record_variables() {
+        for (const PostfixToken& item : postfix_tokens) {
+          if (item.kind != TOKEN_VARIABLE) {
+            continue;
+          }
+
+          if (item.value >= variable_used.size()) {
+            variable_used.resize(symbols::count(), 0);
+          }
+          if (!variable_used[item.value]) {
+            variable_used[item.value] = 1;
+            used_variables.push_back(item.value);
+          }
+        }
+      }
+
+      /**
+      * Cleanup method to reset the module state when working with a new
+      * expression to convert. Only needs to be called in the convert() method,
+      * as repeated calls to evaluate() should return the same result (cached
+      * from the initial call).
+      *
+      * An expression edited with convert_edit() is accepted as it was left,
+      * if it was left valid.
+      */
+      void reset() {
+        if (editing && invalid_offset == string::npos) {
+          record_variables();
+        }
+        editing = false;
+
+        postfix_tokens.clear();
+        number_text.clear();
+        postfix_text.clear();
+        rendered_ends.clear();
+        operator_stack.clear();
+        expression = "";
+        has_vars = false;
+        open_groups = 0;
+        expression_tokens.clear();
+        token_offsets.clear();
+        checkpoints.clear();
+        flush_start = 0;
+        invalid_offset = string::npos;
+        peak_operator_depth = 0;
+      }
+
+      /**
+      * Processes a single infix token of a known kind. Returns false, without
+      * changing anything, if the token is invalid or closes a group that was
+      * never opened.
+      */
+      bool process_classified_token(const string& token, InfixKind kind) {
+        switch (kind) {
+          // Flag variables so we don't try to evaluate the expression later on
+          case INFIX_VARIABLE:
+            has_vars = true;
+            process_variable(token);
+            break;
+          case INFIX_NUMBER:
+            process_number(token);
+            break;
+          case INFIX_GROUP_OPENED:
+            process_group_opened();
+            break;
+          case INFIX_OPERATION:
+            process_operation(token);
+            break;
+          case INFIX_GROUP_CLOSED:
+            if (open_groups == 0) {
+              return false;
+            }
+            process_group_closed();
+            break;
+          case INFIX_INVALID:
+            return false;
+        }
+
+        if (operator_stack.size() > peak_operator_depth) {
+          peak_operator_depth = operator_stack.size();
+        }
+
+        return true;
+      }
+
+      /**
+      * Processes a single infix token according to what kind of token it is.
+      * Returns false if it can't be processed.
+      */
+      bool process_infix_token(const string& token) {
+        return process_classified_token(token, classify_infix_token(token));
+      }
+
+      /**
+      * Adds the remaining operations from the operator stack once every infix
+      * token has been processed.
+      */
+      void flush_operator_stack() {
+        while (!operator_stack.empty()) {
+          push_operation(operator_stack.top());
+          operator_stack.pop();
+        }
+      }
+
+      /**
+      * Runs through every token in an infix expression string, whose kinds
+      * are already known, and generates a postfix expression as a list of
+      * tokens.
+      */
+      void process_infix_tokens(const vector<string>& infix_tokens,
+                                const vector<InfixKind>& kinds) {
+        // Loop through each token from the infix expression and process it
+        // according to what kind of token it is.
+        for (size_t i = 0; i < infix_tokens.size(); i++) {
+          // We've received an invalid token, so we should throw an error.
+          if (!process_classified_token(infix_tokens[i], kinds[i])) {
+            error::throw_error(error::ERR_INVALID_TOKEN);
+          }
+        }
+
+        // Almost finished. Add the remaining operations from the operator stack.
+        flush_operator_stack();
+      }
+
+
+      //------------------------------------------------------------------------
+      //                        Incremental conversion
+      //------------------------------------------------------------------------
+
+      /**
+      * Pushes back onto the operator stack the operations that were popped off
+      * it and appended to postfix_tokens[begin, end), restoring the stack as
+      * it was before they were popped.
+      */
+      void restore_popped_operations(size_t begin, size_t end) {
+        for (size_t i = end; i-- > begin; ) {
+          operator_stack.push(string(1, static_cast<char>(postfix_tokens[i].value)));
+        }
+      }
+
+      /**
+      * Reverses the operator stack changes made by processing infix token i.
+      *
+      * An operand appends itself and leaves the stack alone. Every other token
+      * pops the operations it appended, and then either pushes itself or, for
+      * a ')', also pops the matching '('.
+      */
+      void undo_infix_token(size_t i) {
+        size_t begin = checkpoints[i].postfix_size;
+        size_t end = i + 1 < checkpoints.size() ? checkpoints[i + 1].postfix_size : flush_start;
+
+        if (begin < end && postfix_tokens[begin].kind != TOKEN_OPERATION) {
+          return;
+        }
+
+        if (expression_tokens[i] == ")") {
+          operator_stack.push("(");
+        }
+        else {
+          operator_stack.pop();
+        }
+
+        restore_popped_operations(begin, end);
+      }
+
+      /**
+      * Rolls the module state back to how it was before infix token first was
+      * processed, discarding that token and every one after it. Undoing each
+      * token costs about as much as processing it did, so rolling back only
+      * touches the discarded suffix.
+      */
+      void rollback_to(size_t first) {
+        if (first == 0) {
+          postfix_tokens.clear();
+          number_text.clear();
+          operator_stack.clear();
+          has_vars = false;
+          open_groups = 0;
+        }
+        else {
+          // Undo the final flush, then each token from the last one back
+          restore_popped_operations(flush_start, postfix_tokens.size());
+          postfix_tokens.resize(flush_start);
+
+          for (size_t i = checkpoints.size(); i-- > first; ) {
+            undo_infix_token(i);
+          }
+
+          if (first < checkpoints.size()) {
+            postfix_tokens.resize(checkpoints[first].postfix_size);
+            number_text.resize(checkpoints[first].number_text_size);
+            has_vars = checkpoints[first].has_vars;
+            open_groups = checkpoints[first].open_groups;
+          }
+        }
+
+        expression_tokens.resize(first);
+        token_offsets.resize(first);
+        checkpoints.resize(first);
+        truncate_rendering(postfix_tokens.size());
+      }
+
+      /**
+      * Processes infix tokens first onward, saving a checkpoint before each,
+      * then adds the remaining operations from the operator stack.
+      *
+      * Processing stops before a token that can't be processed, which is
+      * dropped along with every token after it. The next edit tokenizes them
+      * again from the last token kept, so the checkpoints stay usable.
+      */
+      void process_infix_tokens_from(size_t first) {
+        invalid_offset = string::npos;
+
+        for (size_t i = first; i < expression_tokens.size(); i++) {
+          TokenCheckpoint checkpoint = { postfix_tokens.size(), number_text.size(),
+                                         has_vars, open_groups };
+
+          if (!process_infix_token(expression_tokens[i])) {
+            invalid_offset = token_offsets[i];
+            expression_tokens.resize(i);
+            token_offsets.resize(i);
+            break;
+          }
+
+          checkpoints.push_back(checkpoint);
+        }
+
+        flush_start = postfix_tokens.size();
+        flush_operator_stack();
+      }
+
+
+      //------------------------------------------------------------------------
+      //                         Workload profiling
+      //------------------------------------------------------------------------
+
+      /**
+      * Distribution of a non-negative integer measurement. Values are counted
+      * in power of two buckets, so percentiles are rounded up to the next
+      * power of two (but never past the largest value seen).
+      */
+      struct Histogram {
+        uint64_t count;
+        uint64_t sum;
+        uint64_t max;
+        uint64_t buckets[65];   // bucket b counts values needing b bits
+
+        Histogram() : count(0), sum(0), max(0) {
+          memset(buckets, 0, sizeof(buckets));
+        }
+
+        void add(uint64_t value) {
+          int bits = value == 0 ? 0 : 64 - __builtin_clzll(value);
+
+          count++;
+          sum += value;
+          buckets[bits]++;
+          if (value > max) {
+            max = value;
+          }
+        }
+
+        double mean() const {
+          return count == 0 ? 0.0 : double(sum) / count;
+        }
+
+        uint64_t percentile(double p) const {
+          uint64_t rank = uint64_t(p * count);
+          uint64_t seen = 0;
+
+          for (int bits = 0; bits < 65; bits++) {
+            seen += buckets[bits];
+            if (seen > rank) {
+              uint64_t bound = bits == 0 ? 0 : (bits == 64 ? UINT64_MAX : (uint64_t(1) << bits) - 1);
+              return bound < max ? bound : max;
+            }
+          }
+
+          return max;
+        }
+      };
+
+      enum ProfileMetric {
+        METRIC_BYTES,
+        METRIC_TOKENS,
+        METRIC_NESTING_DEPTH,
+        METRIC_OPERATOR_DEPTH,
+        METRIC_OPERAND_DEPTH,
+        METRIC_COUNT
+      };
+
+      // Name of each metric in the profile file
+      const char* metric_names[METRIC_COUNT] = {
+        "bytes",
+        "tokens",
+        "nesting_depth",
+        "operator_stack_depth",
+        "operand_stack_depth"
+      };
+
+      bool profiling = false;                   // record each converted expression
+      Histogram profile_metrics[METRIC_COUNT];  // distribution of each metric
+      uint64_t profile_variables = 0;           // variable operands seen
+      uint64_t profile_numbers = 0;             // number operands seen
+
+      /**
+      * Records the shape of the expression that was just converted from the
+      * given infix tokens.
+      */
+      void record_profile(const vector<string>& infix_tokens) {
+        uint64_t bytes = infix_tokens.empty() ? 0 : infix_tokens.size() - 1;
+        uint64_t depth = 0;
+        uint64_t nesting = 0;
+
+        for (const string& token : infix_tokens) {
+          bytes += token.size();
+
+          if (token == "(" && ++depth > nesting) {
+            nesting = depth;
+          }
+          else if (token == ")" && depth > 0) {
+            depth--;
+          }
+        }
+
+        // Replay the postfix expression to find how deep evaluation would go
+        uint64_t operands = 0;
+        uint64_t peak_operands = 0;
+
+        for (const PostfixToken& item : postfix_tokens) {
+          if (item.kind == TOKEN_OPERATION) {
+            operands -= operands > 0 ? 1 : 0;
+            continue;
+          }
+
+          if (++operands > peak_operands) {
+            peak_operands = operands;
+          }
+
+          if (item.kind == TOKEN_VARIABLE) {
+            profile_variables++;
+          }
+          else {
+            profile_numbers++;
+          }
+        }
+
+        profile_metrics[METRIC_BYTES].add(bytes);
+        profile_metrics[METRIC_TOKENS].add(infix_tokens.size());
+        profile_metrics[METRIC_NESTING_DEPTH].add(nesting);
+        profile_metrics[METRIC_OPERATOR_DEPTH].add(peak_operator_depth);
+        profile_metrics[METRIC_OPERAND_DEPTH].add(peak_operands);
+      }
+
+
+#ifdef IN2POST_TRACE_ALLOC
+      //------------------------------------------------------------------------
+      //                         Allocation tracing
+      //------------------------------------------------------------------------
+
+      /**
+      * Namespace alloc_trace
+      *
+      * Attributes the allocations counted by the replaced global operator new
+      * to the expression being converted, split into the tokenize, convert
+      * and evaluate phases. Only compiled into trace builds; every hook below
+      * is an empty macro otherwise.
+      *
+      * Recording never allocates, so the trace doesn't disturb what it
+      * measures. The counters are atomic because sheet workers allocate
+      * concurrently; attributing them to an expression assumes a single
+      * converting thread, which is how file batches run.
+      */
+      namespace alloc_trace {
+        enum Phase {
+          PHASE_TOKENIZE,
+          PHASE_CONVERT,
+          PHASE_EVALUATE,
+          PHASE_COUNT
+        };
+
+        const char* phase_names[PHASE_COUNT] = { "tokenize", "convert", "evaluate" };
+
+        const int MAX_TOP = 100;        // most expensive expressions kept
+        const size_t TEXT_SIZE = 40;    // characters of each expression kept
+
+        // Updated by the global allocation hooks, from any thread
+        atomic<uint64_t> allocations(0);   // allocations made so far
+        atomic<uint64_t> allocated(0);     // bytes allocated so far
+        atomic<uint64_t> live(0);          // bytes currently allocated
+        atomic<uint64_t> peak(0);          // most bytes live since the last begin()
+
+        /**
+        * Allocations made for a single expression.
+        */
+        struct ExpressionTrace {
+          uint64_t line;                        // input line of the expression
+          uint64_t allocations[PHASE_COUNT];    // allocations in each phase
+          uint64_t bytes[PHASE_COUNT];          // bytes allocated in each phase
+          uint64_t peak;                        // peak live bytes above the start
+          char text[TEXT_SIZE];                 // start of the expression
+
+          uint64_t total_allocations() const {
+            return allocations[PHASE_TOKENIZE] + allocations[PHASE_CONVERT]
+                   + allocations[PHASE_EVALUATE];
+          }
+
+          uint64_t total_bytes() const {
+            return bytes[PHASE_TOKENIZE] + bytes[PHASE_CONVERT] + bytes[PHASE_EVALUATE];
+          }
+        };
+
+        bool active = false;            // an expression is being traced
+        ExpressionTrace current;        // trace of that expression
+        uint64_t mark_allocations;      // allocations when the last phase ended
+        uint64_t mark_allocated;        // bytes allocated when the last phase ended
+        uint64_t base_live;             // live bytes when the expression started
+
+        uint64_t first_line = 0;        // input line of the first expression
+        uint64_t expressions = 0;       // expressions traced so far
+
+        ExpressionTrace top[MAX_TOP];   // most bytes allocated first
+        int top_size = 0;
+
+        Histogram bytes_per_expression;
+        Histogram peak_per_expression;
+
+        void on_allocate(size_t size) {
+          allocations.fetch_add(1, memory_order_relaxed);
+          allocated.fetch_add(size, memory_order_relaxed);
+          uint64_t now = live.fetch_add(size, memory_order_relaxed) + size;
+          uint64_t seen = peak.load(memory_order_relaxed);
+          while (now > seen && !peak.compare_exchange_weak(seen, now, memory_order_relaxed)) {
+          }
+        }
+
+        void on_free(size_t size) {
+          live.fetch_sub(size, memory_order_relaxed);
+        }
+
+        /**
+        * Starts tracing a new expression.
+        */
+        void begin() {
+          memset(&current, 0, sizeof(current));
+          mark_allocations = allocations.load(memory_order_relaxed);
+          mark_allocated = allocated.load(memory_order_relaxed);
+          base_live = live.load(memory_order_relaxed);
+          peak.store(base_live, memory_order_relaxed);
+          active = true;
+        }
+
+        /**
+        * Charges everything allocated since the last phase ended to phase.
+        */
+        void end_phase(Phase phase) {
+          uint64_t now_allocations = allocations.load(memory_order_relaxed);
+          uint64_t now_allocated = allocated.load(memory_order_relaxed);
+          current.allocations[phase] += now_allocations - mark_allocations;
+          current.bytes[phase] += now_allocated - mark_allocated;
+          mark_allocations = now_allocations;
+          mark_allocated = now_allocated;
+        }
+
+        /**
+        * Ends the tokenize phase and keeps the start of the expression.
+        */
+        void tokenized(const vector<string>& tokens) {
+          if (!active) {
+            return;
+          }
+
+          end_phase(PHASE_TOKENIZE);
+
+          size_t n = 0;
+          for (const string& token : tokens) {
+            if (n > 0 && n < TEXT_SIZE - 1) {
+              current.text[n++] = ' ';
+            }
+            for (size_t i = 0; i < token.size() && n < TEXT_SIZE - 1; i++) {
+              current.text[n++] = token[i];
+            }
+          }
+          current.text[n] = '\0';
+        }
+
+        void converted() {
+          if (active) {
+            end_phase(PHASE_CONVERT);
+          }
+        }
+
+        /**
+        * Ends the evaluate phase and files the finished expression trace.
+        */
+        void evaluated() {
+          if (!active) {
+            return;
+          }
+
+          end_phase(PHASE_EVALUATE);
+          current.peak = peak.load(memory_order_relaxed) - base_live;
+          current.line = first_line + expressions++;
+          active = false;
+
+          bytes_per_expression.add(current.total_bytes());
+          peak_per_expression.add(current.peak);
+
+          // Insert into the top list, which stays sorted by bytes allocated
+          int i = top_size < MAX_TOP ? top_size++ : MAX_TOP - 1;
+          if (i == MAX_TOP - 1 && top_size == MAX_TOP
+              && top[i].total_bytes() >= current.total_bytes()) {
+            return;
+          }
+
+          for (; i > 0 && top[i - 1].total_bytes() < current.total_bytes(); i--) {
+            top[i] = top[i - 1];
+          }
+          top[i] = current;
+        }
+
+        /**
+        * Ends the evaluate phase when it goes out of scope, after the result
+        * has been built.
+        */
+        struct EvaluationScope {
+          ~EvaluationScope() {
+            evaluated();
+          }
+        };
+
+      }   // end of namespace alloc_trace
+
+#define TRACE_BEGIN() alloc_trace::begin()
+#define TRACE_TOKENIZED(tokens) alloc_trace::tokenized(tokens)
+#define TRACE_CONVERTED() alloc_trace::converted()
+#define TRACE_EVALUATION_SCOPE() alloc_trace::EvaluationScope trace_evaluation_scope
+#else
+#define TRACE_BEGIN()
+#define TRACE_TOKENIZED(tokens)
+#define TRACE_CONVERTED()
+#define TRACE_EVALUATION_SCOPE()
+#endif
+
+
+      //------------------------------------------------------------------------
+      //                     Bulk input tokenizer pre-pass
+      //------------------------------------------------------------------------
+
+      // Number of input bytes classified at a time by the tokenizer pre-pass.
+      const size_t BLOCK_SIZE = 64;
+
+      // Default size of each read from a bulk input stream. A loaded profile
+      // may pick a smaller size that keeps each chunk in cache.
+      const size_t CHUNK_SIZE = 1 << 20;
+      const size_t MIN_CHUNK_SIZE = 64 << 10;
+      const size_t MAX_CHUNK_SIZE = 16 << 20;
+
+      size_t chunk_size = CHUNK_SIZE;   // size of each read from a bulk input stream
+
+      /**
+      * Bitmasks classifying a block of BLOCK_SIZE input bytes. Bit i of each
+      * mask is set if byte i of the block belongs to that class.
+      */
+      struct ByteClassMasks {
+        uint64_t spaces;        // ' ', the token separator
+        uint64_t newlines;      // '\n', the expression separator
+        uint64_t digits;        // [0-9]
+        uint64_t identifiers;   // [0-9a-zA-Z_]
+        uint64_t operators;     // [+-*/]
+        uint64_t parens;        // '(' and ')'
+        uint64_t dots;          // '.', the decimal point
+      };
+
+      /**
+      * Classifies a block one byte at a time. Used when no vector instruction
+      * set is available.
+      */
+      ByteClassMasks classify_block_scalar(const char* block) {
+        ByteClassMasks m = {0, 0, 0, 0, 0, 0, 0};
+
+        for (size_t i = 0; i < BLOCK_SIZE; i++) {
+          unsigned char c = block[i];
+          uint64_t bit = uint64_t(1) << i;
+          unsigned char lower = c | 0x20;
+
+          if (c == ' ') {
+            m.spaces |= bit;
+          }
+          else if (c == '\n') {
+            m.newlines |= bit;
+          }
+          else if (c >= '0' && c <= '9') {
+            m.digits |= bit;
+            m.identifiers |= bit;
+          }
+          else if ((lower >= 'a' && lower <= 'z') || c == '_') {
+            m.identifiers |= bit;
+          }
+          else if (c == '+' || c == '-' || c == '*' || c == '/') {
+            m.operators |= bit;
+          }
+          else if (c == '(' || c == ')') {
+            m.parens |= bit;
+          }
+          else if (c == '.') {
+            m.dots |= bit;
+          }
+        }
+
+        return m;
+      }
+
+#ifdef IN2POST_X86
+      /**
+      * Returns a mask of the bytes in c that fall within [lo, hi]. Bytes above
+      * 0x7f compare as negative and are never matched.
+      */
+      __attribute__((target("sse2")))
+      inline __m128i in_range_sse2(__m128i c, char lo, char hi) {
+        return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)),
+                             _mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)));
+      }
+
+      __attribute__((target("sse2")))
+      inline uint64_t movemask_sse2(__m128i x) {
+        return uint16_t(_mm_movemask_epi8(x));
+      }
+
+      /**
+      * Classifies a block 16 bytes at a time using SSE2.
+      */
+      __attribute__((target("sse2")))
+      ByteClassMasks classify_block_sse2(const char* block) {
+        ByteClassMasks m = {0, 0, 0, 0, 0, 0, 0};
+
+        for (size_t i = 0; i < BLOCK_SIZE; i += 16) {
+          __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i));
+          __m128i digits = in_range_sse2(c, '0', '9');
+          __m128i letters = in_range_sse2(_mm_or_si128(c, _mm_set1_epi8(0x20)), 'a', 'z');
+          __m128i underscores = _mm_cmpeq_epi8(c, _mm_set1_epi8('_'));
+          __m128i operators = _mm_or_si128(
+              _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('+')),
+                           _mm_cmpeq_epi8(c, _mm_set1_epi8('-'))),
+              _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('*')),
+                           _mm_cmpeq_epi8(c, _mm_set1_epi8('/'))));
+          __m128i parens = _mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('(')),
+                                        _mm_cmpeq_epi8(c, _mm_set1_epi8(')')));
+
+          m.spaces |= movemask_sse2(_mm_cmpeq_epi8(c, _mm_set1_epi8(' '))) << i;
+          m.newlines |= movemask_sse2(_mm_cmpeq_epi8(c, _mm_set1_epi8('\n'))) << i;
+          m.digits |= movemask_sse2(digits) << i;
+          m.identifiers |= movemask_sse2(
+              _mm_or_si128(digits, _mm_or_si128(letters, underscores))) << i;
+          m.operators |= movemask_sse2(operators) << i;
+          m.parens |= movemask_sse2(parens) << i;
+          m.dots |= movemask_sse2(_mm_cmpeq_epi8(c, _mm_set1_epi8('.'))) << i;
+        }
+
+        return m;
+      }
+
+      __attribute__((target("avx2")))
+      inline __m256i in_range_avx2(__m256i c, char lo, char hi) {
+        return _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8(lo - 1)),
+                                _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), c));
+      }
+
+      __attribute__((target("avx2")))
+      inline uint64_t movemask_avx2(__m256i x) {
+        return uint32_t(_mm256_movemask_epi8(x));
+      }
+
+      /**
+      * Classifies a block 32 bytes at a time using AVX2.
+      */
+      __attribute__((target("avx2")))
+      ByteClassMasks classify_block_avx2(const char* block) {
+        ByteClassMasks m = {0, 0, 0, 0, 0, 0, 0};
+
+        for (size_t i = 0; i < BLOCK_SIZE; i += 32) {
+          __m256i c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + i));
+          __m256i digits = in_range_avx2(c, '0', '9');
+          __m256i letters = in_range_avx2(_mm256_or_si256(c, _mm256_set1_epi8(0x20)), 'a', 'z');
+          __m256i underscores = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('_'));
+          __m256i operators = _mm256_or_si256(
+              _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('+')),
+                              _mm256_cmpeq_epi8(c, _mm256_set1_epi8('-'))),
+              _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('*')),
+                              _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'))));
+          __m256i parens = _mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('(')),
+                                           _mm256_cmpeq_epi8(c, _mm256_set1_epi8(')')));
+
+          m.spaces |= movemask_avx2(_mm256_cmpeq_epi8(c, _mm256_set1_epi8(' '))) << i;
+          m.newlines |= movemask_avx2(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('\n'))) << i;
+          m.digits |= movemask_avx2(digits) << i;
+          m.identifiers |= movemask_avx2(
+              _mm256_or_si256(digits, _mm256_or_si256(letters, underscores))) << i;
+          m.operators |= movemask_avx2(operators) << i;
+          m.parens |= movemask_avx2(parens) << i;
+          m.dots |= movemask_avx2(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('.'))) << i;
+        }
+
+        return m;
+      }
+#endif
+
+      typedef ByteClassMasks (*BlockClassifier)(const char*);
+
+      /**
+      * Picks the widest block classifier supported by the running CPU.
+      */
+      BlockClassifier select_classifier() {
+#ifdef IN2POST_X86
+        if (__builtin_cpu_supports("avx2")) {
+          return classify_block_avx2;
+        }
+        if (__builtin_cpu_supports("sse2")) {
+          return classify_block_sse2;
+        }
+#endif
+        return classify_block_scalar;
+      }
+
+      // Classifier used for bulk input, chosen once at startup
+      const BlockClassifier classify_block = select_classifier();
+
+      /**
+      * Returns a mask of bits [lo, hi) of a block, for lo <= hi <= BLOCK_SIZE.
+      */
+      uint64_t bit_range(size_t lo, size_t hi) {
+        uint64_t below_hi = hi >= BLOCK_SIZE ? ~uint64_t(0) : (uint64_t(1) << hi) - 1;
+        uint64_t below_lo = lo >= BLOCK_SIZE ? ~uint64_t(0) : (uint64_t(1) << lo) - 1;
+
+        return below_hi & ~below_lo;
+      }
+
+      /**
+      * The byte classes shared by every byte of a token, gathered from the
+      * block masks of each block the token spans. Together with its first and
+      * last byte, they decide the token's kind exactly as the regular
+      * expressions would.
+      */
+      struct TokenScan {
+        bool identifier;    // every byte is in [0-9a-zA-Z_]
+        bool numeric;       // every byte is a digit or '.'
+        bool operation;     // every byte is in [+-*/]
+        bool paren;         // every byte is '(' or ')'
+        int dots;           // number of '.' bytes, counting only up to 2
+
+        TokenScan() : identifier(true), numeric(true), operation(true), paren(true), dots(0) {}
+
+        /**
+        * Adds the bytes of the token selected by bits from a block.
+        */
+        void add(const ByteClassMasks& m, uint64_t bits) {
+          uint64_t token_dots = m.dots & bits;
+
+          identifier &= (m.identifiers & bits) == bits;
+          numeric &= ((m.digits | m.dots) & bits) == bits;
+          operation &= (m.operators & bits) == bits;
+          paren &= (m.parens & bits) == bits;
+          dots += (token_dots != 0) + ((token_dots & (token_dots - 1)) != 0);
+        }
+
+        /**
+        * Returns the kind of the token once all its bytes have been added.
+        */
+        InfixKind kind(const char* token, size_t length) const {
+          if (length == 0) {
+            return INFIX_INVALID;
+          }
+
+          // Kinds alternate from token to token, so rather than branching on
+          // each test, the tests (at most one of which passes) pick an entry
+          static const InfixKind kinds[] = {
+            INFIX_INVALID, INFIX_VARIABLE, INFIX_NUMBER, INFIX_OPERATION,
+            INFIX_GROUP_OPENED, INFIX_GROUP_CLOSED
+          };
+
+          unsigned digit_first = unsigned(token[0] - '0') < 10;
+          unsigned single = length == 1;
+
+          // [a-zA-Z]+[0-9a-zA-Z_]*
+          unsigned variable = identifier & !digit_first & (token[0] != '_');
+          // [0-9]+(\.?[0-9]+)?
+          unsigned number = numeric & (dots <= 1) & digit_first & (token[length - 1] != '.');
+          unsigned group = single & paren;
+
+          return kinds[variable + 2 * number + 3 * (single & operation)
+                       + group * (4 + (token[0] == ')'))];
+        }
+      };
+
+      /**
+      * Fills seps with the offset of every token separator (' ') and
+      * expression separator ('\n') in buf, in increasing order, and kinds
+      * with the kind of the token ending at each. The kind of the token after
+      * the last separator is added at the end of kinds.
+      */
+      void find_separators(BlockClassifier classify, const char* buf, size_t len,
+                           vector<size_t>& seps, vector<InfixKind>& kinds) {
+        char tail[BLOCK_SIZE];   // zero-padded copy of a partial final block
+        TokenScan token;         // classes of the token being scanned
+        size_t token_start = 0;  // offset of the token being scanned
+
+        seps.clear();
+        kinds.clear();
+
+        for (size_t base = 0; base < len; base += BLOCK_SIZE) {
+          const char* block = buf + base;
+          size_t end = BLOCK_SIZE;
+
+          if (len - base < BLOCK_SIZE) {
+            memset(tail, 0, BLOCK_SIZE);
+            memcpy(tail, block, len - base);
+            block = tail;
+            end = len - base;
+          }
+
+          ByteClassMasks m = classify(block);
+          uint64_t bits = m.spaces | m.newlines;
+          size_t lo = token_start > base ? token_start - base : 0;
+
+          // Pull out the offset of each set bit, lowest first, and classify
+          // the token it ends
+          size_t count = seps.size();
+          seps.resize(count + __builtin_popcountll(bits));
+          kinds.resize(seps.size());
+          while (bits != 0) {
+            size_t bit = __builtin_ctzll(bits);
+
+            token.add(m, bit_range(lo, bit));
+            seps[count] = base + bit;
+            kinds[count] = token.kind(buf + token_start, base + bit - token_start);
+            count++;
+
+            token = TokenScan();
+            token_start = base + bit + 1;
+            lo = bit + 1;
+            bits &= bits - 1;
+          }
+
+          token.add(m, bit_range(lo, end));
+        }
+
+        kinds.push_back(token.kind(buf + token_start, len - token_start));
+      }
+
+      /**
+      * Converts and evaluates one expression that has already been split into
+      * tokens, writing its evaluation to the output stream.
+      */
+      void convert_tokens(const vector<string>& infix_tokens,
+                          const vector<InfixKind>& kinds, ostream& out) {
+        reset();
+        process_infix_tokens(infix_tokens, kinds);
+        record_variables();
+        TRACE_CONVERTED();
+        if (profiling) {
+          record_profile(infix_tokens);
+        }
+        out << evaluate() << '\n';
+      }
+
+      /**
+      * Splits every line in buf into tokens using the separator offsets and
+      * token kinds found by the pre-pass and converts each line in turn,
+      * stopping after max_lines lines. Returns the number of lines converted
+      * and sets consumed to the number of bytes of buf they took up.
+      *
+      * Tokens are split exactly as tokenize_infix_expression() splits them
+      * and given the kind the regular expressions would give them, so both
+      * paths accept and reject the same expressions.
+      */
+      uint64_t convert_lines(const char* buf, size_t len, ostream& out,
+                             uint64_t max_lines, size_t& consumed) {
+        static vector<size_t> seps;
+        static vector<InfixKind> kinds;
+        static vector<string> infix_tokens;
+        static vector<InfixKind> infix_kinds;
+
+        find_separators(classify_block, buf, len, seps, kinds);
+        TRACE_BEGIN();
+
+        size_t token_start = 0;     // offset of the token being scanned
+        size_t line_start = 0;      // offset of the line being scanned
+        uint64_t lines = 0;         // lines converted so far
+        infix_tokens.clear();
+        infix_kinds.clear();
+
+        for (size_t i = 0; i < seps.size(); i++) {
+          size_t pos = seps[i];
+
+          if (buf[pos] == ' ' || pos > token_start) {
+            infix_tokens.emplace_back(buf + token_start, pos - token_start);
+            infix_kinds.push_back(kinds[i]);
+          }
+
+          if (buf[pos] == '\n') {
+            TRACE_TOKENIZED(infix_tokens);
+            convert_tokens(infix_tokens, infix_kinds, out);
+            infix_tokens.clear();
+            infix_kinds.clear();
+            line_start = pos + 1;
+            TRACE_BEGIN();
+
+            if (++lines == max_lines) {
+              consumed = line_start;
+              return lines;
+            }
+          }
+
+          token_start = pos + 1;
+        }
+
+        // Final line without a terminating newline
+        if (line_start < len) {
+          if (token_start < len) {
+            infix_tokens.emplace_back(buf + token_start, len - token_start);
+            infix_kinds.push_back(kinds[seps.size()]);
+          }
+
+          TRACE_TOKENIZED(infix_tokens);
+          convert_tokens(infix_tokens, infix_kinds, out);
+          lines++;
+        }
+
+        consumed = len;
+        return lines;
+      }
+
+      /**
+      * Converts up to max_lines lines of a bulk input stream.
+      *
+      * The stream is read in large chunks. Each chunk is cut after its last
+      * newline and the incomplete final line is carried over to the next read.
+      * After each chunk, checkpoint is called with the number of lines and
+      * input bytes converted so far.
+      */
+      void convert_chunks(istream& in, ostream& out, uint64_t max_lines,
+                          const function<void(uint64_t, uint64_t)>& checkpoint) {
+        string buffer;        // unconverted input, always starting at a line
+        size_t carried = 0;   // bytes of buffer carried over from the last read
+        uint64_t lines = 0;   // lines converted so far
+        uint64_t bytes = 0;   // input bytes converted so far
+        size_t consumed;      // bytes taken up by the lines of one chunk
+
+        while (in && lines < max_lines) {
+          buffer.resize(carried + chunk_size);
+          in.read(&buffer[carried], chunk_size);
+          buffer.resize(carried + in.gcount());
+
+          size_t last_newline = buffer.rfind('\n');
+          if (last_newline == string::npos) {
+            carried = buffer.size();
+            continue;
+          }
+
+          lines += convert_lines(buffer.data(), last_newline + 1, out,
+                                 max_lines - lines, consumed);
+          bytes += consumed;
+          buffer.erase(0, consumed);
+          carried = buffer.size();
+          checkpoint(lines, bytes);
+        }
+
+        if (!buffer.empty() && lines < max_lines) {
+          lines += convert_lines(buffer.data(), buffer.size(), out,
+                                 max_lines - lines, consumed);
+          bytes += consumed;
+          checkpoint(lines, bytes);
+        }
+      }
+
+
+      //------------------------------------------------------------------------
+      //                      Resumable file batches
+      //------------------------------------------------------------------------
+
+      // Every INDEX_STRIDE-th line start is recorded in a line index
+      const uint64_t INDEX_STRIDE = 1024;
+
+      // Start of every line index file, naming its format
+      const char INDEX_MAGIC[8] = { 'i', 'n', '2', 'p', 'i', 'd', 'x', '2' };
+
+      /**
+      * Identifies one version of a file. Rewriting a file changes its
+      * modification time even if its size stays the same, and replacing it
+      * with another file changes its inode.
+      */
+      struct FileStamp {
+        uint64_t size;          // size in bytes
+        uint64_t mtime_sec;     // last modification time, seconds part
+        uint64_t mtime_nsec;    // last modification time, nanoseconds part
+        uint64_t inode;         // inode number
+      };
+
+      bool operator==(const FileStamp& lhs, const FileStamp& rhs) {
+        return lhs.size == rhs.size && lhs.mtime_sec == rhs.mtime_sec
+               && lhs.mtime_nsec == rhs.mtime_nsec && lhs.inode == rhs.inode;
+      }
+
+      bool operator!=(const FileStamp& lhs, const FileStamp& rhs) {
+        return !(lhs == rhs);
+      }
+
+      /**
+      * Sparse index of the line starts of an input file, stored next to it in
+      * "<input>.idx". Entry i is the offset of line i * INDEX_STRIDE, so any
+      * line can be reached by seeking to an entry and skipping fewer than
+      * INDEX_STRIDE lines.
+      */
+      struct LineIndex {
+        FileStamp input;            // version of the input that was indexed
+        uint64_t lines;             // number of lines in the input
+        vector<uint64_t> offsets;   // offset of every INDEX_STRIDE-th line
+      };
+
+      /**
+      * Progress of a batch job, saved in "<output>.ckpt" after every chunk.
+      */
+      struct Checkpoint {
+        FileStamp input;          // version of the input file
+        uint64_t first_line;      // first line of the job's range
+        uint64_t end_line;        // line the job stops before
+        uint64_t next_line;       // first line not yet converted
+        uint64_t input_offset;    // offset of next_line in the input
+        uint64_t output_offset;   // output size once next_line - 1 was written
+      };
+
+      /**
+      * Returns the stamp of a file, or throws an error if it can't be read.
+      */
+      FileStamp file_stamp(const string& path) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+          error::throw_error(error::ERR_FILE_IO);
+        }
+
+        return { uint64_t(st.st_size), uint64_t(st.st_mtim.tv_sec),
+                 uint64_t(st.st_mtim.tv_nsec), uint64_t(st.st_ino) };
+      }
+
+      /**
+      * Forces the contents of a file or directory that were already written
+      * out to stable storage. Returns ERR_FILE_IO if they couldn't be.
+      */
+      error::ErrorCode sync_file(const string& path) {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+          return error::ERR_FILE_IO;
+        }
+
+        bool synced = fsync(fd) == 0;
+        close(fd);
+
+        return synced ? error::ERR_NONE : error::ERR_FILE_IO;
+      }
+
+      /**
+      * Writes contents to path by way of a temporary file and a rename, so
+      * readers see either the old file or the complete new one. The data is
+      * synced before the rename and the rename after it, so after a crash
+      * the file is still either the old one or the complete new one.
+      *
+      * Returns ERR_FILE_IO, leaving no temporary file behind, if the file
+      * couldn't be written, such as in a read-only directory.
+      */
+      error::ErrorCode write_atomically(const string& path, const string& contents) {
+        string temp = path + ".tmp." + to_string(getpid());
+        size_t slash = path.rfind('/');
+        bool written;
+
+        {
+          ofstream out(temp, ios::binary | ios::trunc);
+          out.write(contents.data(), contents.size());
+          out.flush();
+          written = bool(out);
+        }
+
+        if (!written || sync_file(temp) != error::ERR_NONE
+            || rename(temp.c_str(), path.c_str()) != 0) {
+          unlink(temp.c_str());
+          return error::ERR_FILE_IO;
+        }
+
+        return sync_file(slash == string::npos ? "." : path.substr(0, slash + 1));
+      }
+
+      /**
+      * Scans an input file for newlines with the block classifier and records
+      * the start of every INDEX_STRIDE-th line.
+      */
+      LineIndex build_line_index(const string& input) {
+        LineIndex index = { file_stamp(input), 0, { 0 } };
+        ifstream in(input, ios::binary);
+        vector<char> chunk(chunk_size + BLOCK_SIZE);
+        uint64_t base = 0;          // offset of chunk in the input
+        char last = '\n';           // last byte of the input
+
+        while (in.read(chunk.data(), chunk_size) || in.gcount() > 0) {
+          size_t len = in.gcount();
+          memset(chunk.data() + len, 0, BLOCK_SIZE);
+          last = chunk[len - 1];
+
+          for (size_t block = 0; block < len; block += BLOCK_SIZE) {
+            uint64_t bits = classify_block(chunk.data() + block).newlines;
+
+            while (bits != 0) {
+              if (++index.lines % INDEX_STRIDE == 0) {
+                index.offsets.push_back(base + block + __builtin_ctzll(bits) + 1);
+              }
+              bits &= bits - 1;
+            }
+          }
+
+          base += len;
+        }
+
+        // Final line without a terminating newline
+        if (last != '\n') {
+          index.lines++;
+        }
+
+        return index;
+      }
+
+      /**
+      * Returns the line index of an input file, reading it from "<input>.idx"
+      * if that was made from the current version of the input and otherwise
+      * building and saving it. If it can't be saved, that is reported and
+      * the job goes on with the index it built.
+      */
+      LineIndex load_line_index(const string& input) {
+        string path = input + ".idx";
+        LineIndex index;
+        char magic[sizeof(INDEX_MAGIC)] = {};
+        uint64_t entries = 0;
+        ifstream in(path, ios::binary);
+
+        in.read(magic, sizeof(magic));
+        in.read(reinterpret_cast<char*>(&index.input), sizeof(FileStamp));
+        in.read(reinterpret_cast<char*>(&index.lines), sizeof(uint64_t));
+        in.read(reinterpret_cast<char*>(&entries), sizeof(uint64_t));
+
+        if (in && memcmp(magic, INDEX_MAGIC, sizeof(magic)) == 0
+            && index.input == file_stamp(input)) {
+          index.offsets.resize(entries);
+          in.read(reinterpret_cast<char*>(index.offsets.data()), entries * sizeof(uint64_t));
+          if (in) {
+            return index;
+          }
+        }
+
+        index = build_line_index(input);
+        entries = index.offsets.size();
+
+        string contents(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+        contents.append(reinterpret_cast<const char*>(&index.input), sizeof(FileStamp));
+        contents.append(reinterpret_cast<const char*>(&index.lines), sizeof(uint64_t));
+        contents.append(reinterpret_cast<const char*>(&entries), sizeof(uint64_t));
+        contents.append(reinterpret_cast<const char*>(index.offsets.data()),
+                        entries * sizeof(uint64_t));
+        // The index is only a cache, so a job over a read-only input keeps
+        // it in memory instead
+        if (write_atomically(path, contents) != error::ERR_NONE) {
+          error::report_error(error::ERR_INDEX_NOT_SAVED);
+        }
+
+        return index;
+      }
+
+      /**
+      * Returns the offset of a line in the input, using the line index to skip
+      * straight to the nearest indexed line before it.
+      */
+      uint64_t line_offset(const string& input, uint64_t line) {
+        LineIndex index = load_line_index(input);
+        if (line >= index.lines) {
+          return index.input.size;
+        }
+
+        ifstream in(input, ios::binary);
+        in.seekg(index.offsets[line / INDEX_STRIDE]);
+
+        for (uint64_t skip = line % INDEX_STRIDE; skip > 0; skip--) {
+          in.ignore(numeric_limits<streamsize>::max(), '\n');
+        }
+
+        return in.tellg();
+      }
+
+      /**
+      * Writes a checkpoint file atomically.
+      */
+      void write_checkpoint(const string& path, const Checkpoint& c) {
+        ostringstream out;
+
+        out << "# in2post checkpoint" << endl
+            << "input_size " << c.input.size << endl
+            << "input_mtime_sec " << c.input.mtime_sec << endl
+            << "input_mtime_nsec " << c.input.mtime_nsec << endl
+            << "input_inode " << c.input.inode << endl
+            << "first_line " << c.first_line << endl
+            << "end_line " << c.end_line << endl
+            << "next_line " << c.next_line << endl
+            << "input_offset " << c.input_offset << endl
+            << "output_offset " << c.output_offset << endl;
+
+        error::ErrorCode err = write_atomically(path, out.str());
+        if (err != error::ERR_NONE) {
+          error::throw_error(err);
+        }
+      }
+
+      /**
+      * Reads a checkpoint file. Returns false if there is none.
+      */
+      bool read_checkpoint(const string& path, Checkpoint& c) {
+        ifstream in(path);
+        if (!in) {
+          return false;
+        }
+
+        const struct {
+          const char* name;
+          uint64_t* value;
+        } fields[] = {
+          { "input_size", &c.input.size },
+          { "input_mtime_sec", &c.input.mtime_sec },
+          { "input_mtime_nsec", &c.input.mtime_nsec },
+          { "input_inode", &c.input.inode },
+          { "first_line", &c.first_line },
+          { "end_line", &c.end_line },
+          { "next_line", &c.next_line },
+          { "input_offset", &c.input_offset },
+          { "output_offset", &c.output_offset }
+        };
+
+        string line;
+        string name;
+        int found = 0;    // number of fields read
+
+        while (getline(in, line)) {
+          istringstream values(line);
+          values >> name;
+
+          for (const auto& field : fields) {
+            if (name == field.name && values >> *field.value) {
+              found++;
+            }
+          }
+        }
+
+        if (found != 9) {
+          error::throw_error(error::ERR_CHECKPOINT_MISMATCH);
+        }
+
+        return true;
+      }
+
+
+      //------------------------------------------------------------------------
+      //                           Formula sheets
+      //------------------------------------------------------------------------
+
+      // Smallest number of formulas worth handing to each worker thread
+      const size_t PARALLEL_MIN_FORMULAS = 1024;
+
+      /**
+      * Outcome of a formula's last evaluation.
+      */
+      enum FormulaState {
+        FORMULA_VALUE,        // evaluated to a value
+        FORMULA_UNRESOLVED,   // refers to a name without a value
+        FORMULA_ERROR         // failed, or refers to a formula that did
+      };
+
+      /**
+      * A named sheet formula, kept in converted form so it can be evaluated
+      * again without the module's conversion state.
+      */
+      struct Formula {
+        uint32_t name;                  // symbol id of the formula's name
+        vector<PostfixToken> postfix;   // converted expression
+        string number_text;             // text of its number tokens
+        string postfix_text;            // postfix expression, shown if unresolved
+        vector<uint32_t> inputs;        // distinct symbols it refers to
+        error::ErrorCode invalid;       // why it can't be evaluated at all, or ERR_NONE
+        FormulaState state;             // outcome of the last evaluation
+        error::ErrorCode error;         // what failed, if state is FORMULA_ERROR
+        string display;                 // result of the last evaluation
+      };
+
+      vector<Formula> formulas;             // in order of definition
+      vector<int> formula_of_symbol;        // formula defining each symbol, or -1
+      vector<vector<uint32_t>> dependents;  // formulas referring to each symbol
+      vector<uint32_t> changed_formulas;    // formulas set since the last recalculation
+
+      /**
+      * Values of the resolved formulas in the given numeric type, indexed
+      * like formulas.
+      */
+      template <typename Number>
+      vector<Number>& formula_values() {
+        static vector<Number> values;
+        return values;
+      }
+
+      /**
+      * Returns the formula defining a symbol, or -1 if there is none.
+      */
+      int defining_formula(uint32_t symbol) {
+        return symbol < formula_of_symbol.size() ? formula_of_symbol[symbol] : -1;
+      }
+
+      /**
+      * Marks a formula as failed and shows the error as its result.
+      */
+      void fail_formula(Formula& f, error::ErrorCode ec) {
+        f.state = FORMULA_ERROR;
+        f.error = ec;
+        f.display = "Error: " + error::get_error(ec).message;
+      }
+
+      /**
+      * Evaluates a single formula from the values of the formulas it refers
+      * to. Those are either outside this recalculation or were evaluated in
+      * an earlier wave, so formulas in one wave can be evaluated concurrently.
+      *
+      * A formula referring to a failed formula fails with the same error.
+      * Otherwise, one referring to a name with no value shows its postfix
+      * expression, as evaluate() does for expressions with variables. Errors
+      * are recorded in the formula rather than thrown, since this may run on
+      * a worker thread.
+      */
+      template <typename Number>
+      void evaluate_formula(uint32_t index) {
+        Formula& f = formulas[index];
+        vector<Number>& values = formula_values<Number>();
+        vector<Number> numbers;
+        vector<Number> variables;
+
+        if (f.invalid != error::ERR_NONE) {
+          fail_formula(f, f.invalid);
+          return;
+        }
+
+        bool unresolved = false;
+        for (uint32_t symbol : f.inputs) {
+          int source = defining_formula(symbol);
+          if (source < 0 || formulas[source].state == FORMULA_UNRESOLVED) {
+            unresolved = true;
+          }
+          else if (formulas[source].state == FORMULA_ERROR) {
+            fail_formula(f, formulas[source].error);
+            return;
+          }
+        }
+
+        if (unresolved) {
+          f.state = FORMULA_UNRESOLVED;
+          f.display = f.postfix_text;
+          return;
+        }
+
+        // Values of the formulas it refers to, in the order they appear
+        for (const PostfixToken& item : f.postfix) {
+          if (item.kind == TOKEN_VARIABLE) {
+            variables.push_back(values[defining_formula(item.value)]);
+          }
+        }
+
+        Number result;
+        error::ErrorCode err = parse_numbers(f.postfix, f.number_text, numbers);
+        if (err == error::ERR_NONE) {
+          err = evaluate_parsed_expression(f.postfix, numbers, variables, result);
+        }
+
+        if (err != error::ERR_NONE) {
+          fail_formula(f, err);
+          return;
+        }
+
+        values[index] = result;
+        f.state = FORMULA_VALUE;
+        f.display = format_number(result);
+      }
+
+      /**
+      * Evaluates a wave of mutually independent formulas, splitting it into
+      * contiguous runs across threads when it is large enough to pay off.
+      */
+      template <typename Number>
+      void evaluate_wave(const vector<uint32_t>& wave) {
+        size_t workers = thread::hardware_concurrency();
+        if (workers > wave.size() / PARALLEL_MIN_FORMULAS) {
+          workers = wave.size() / PARALLEL_MIN_FORMULAS;
+        }
+
+        if (workers <= 1) {
+          for (uint32_t index : wave) {
+            evaluate_formula<Number>(index);
+          }
+          return;
+        }
+
+        vector<thread> threads;
+        for (size_t w = 0; w < workers; w++) {
+          threads.emplace_back([&wave, w, workers]() {
+            size_t end = (w + 1) * wave.size() / workers;
+            for (size_t i = w * wave.size() / workers; i < end; i++) {
+              evaluate_formula<Number>(wave[i]);
+            }
+          });
+        }
+
+        for (thread& t : threads) {
+          t.join();
+        }
+      }
+
+      /**
+      * Evaluates the changed formulas and everything downstream of them in
+      * topological waves, then writes their results.
+      */
+      template <typename Number>
+      void recalculate_as(ostream& out) {
+        formula_values<Number>().resize(formulas.size());
+
+        // Collect the changed formulas and everything that depends on them
+        vector<char> affected(formulas.size(), 0);
+        vector<uint32_t> pending = changed_formulas;
+        vector<uint32_t> order;
+
+        while (!pending.empty()) {
+          uint32_t index = pending.back();
+          pending.pop_back();
+
+          if (affected[index]) {
+            continue;
+          }
+          affected[index] = 1;
+          order.push_back(index);
+
+          for (uint32_t dependent : dependents[formulas[index].name]) {
+            pending.push_back(dependent);
+          }
+        }
+        changed_formulas.clear();
+
+        // Count the affected inputs each affected formula is waiting on
+        vector<uint32_t> waiting(formulas.size(), 0);
+        vector<uint32_t> wave;
+
+        for (uint32_t index : order) {
+          for (uint32_t symbol : formulas[index].inputs) {
+            int source = defining_formula(symbol);
+            if (source >= 0 && affected[source]) {
+              waiting[index]++;
+            }
+          }
+
+          if (waiting[index] == 0) {
+            wave.push_back(index);
+          }
+        }
+
+        // Evaluate wave by wave. Formulas that never become ready are on or
+        // downstream of a cycle.
+        while (!wave.empty()) {
+          evaluate_wave<Number>(wave);
+
+          vector<uint32_t> next;
+          for (uint32_t index : wave) {
+            for (uint32_t dependent : dependents[formulas[index].name]) {
+              if (affected[dependent] && --waiting[dependent] == 0) {
+                next.push_back(dependent);
+              }
+            }
+          }
+          wave.swap(next);
+        }
+
+        sort(order.begin(), order.end());
+
+        for (uint32_t index : order) {
+          Formula& f = formulas[index];
+
+          if (waiting[index] > 0) {
+            fail_formula(f, error::ERR_CIRCULAR_REFERENCE);
+          }
+
+          out << symbols::name(f.name) << " = " << f.display << '\n';
+        }
+        out.flush();
+      }
+
+    }   // end of anonymous namespace
+
+
+    //--------------------------------------------------------------------------
+    //               Module in2post public interace definitions
+    //--------------------------------------------------------------------------
+
+    /**
+    * Convert the expression supplied as an argument to a postfix expression.
     *
     * Return the expression as a string.
     */
     string convert(const string& the_exp) {
+      TRACE_BEGIN();
+
       // We're dealing with a new expression here, so reset the module.
       reset();
 
-      string postfix_exp = "";   // temp string for returning postfix exp
-      expression = the_exp;
+      // A new expression is an edit that inserts it into an empty one, but
+      // it's accepted right here rather than once the next one starts
+      string postfix_exp = convert_edit(0, 0, the_exp);
+      editing = false;
+
+      // We've received an invalid token, so we should throw an error.
+      if (invalid_offset != string::npos) {
+        error::throw_error(error::ERR_INVALID_TOKEN);
+      }
+
+      record_variables();
+
+      if (profiling) {
+        record_profile(expression_tokens);
+      }
+
+      return postfix_exp;
+    }
+
+    /**
+    * Apply an edit to the expression and convert it again from the first
+    * token the edit can affect.
+    *
+    * Return the expression as a reference to its rendering.
+    */
+    const string& convert_edit(size_t pos, size_t count, const string& text) {
+      if (pos > expression.size()) {
+        error::throw_error(error::ERR_INVALID_EDIT);
+      }
+      editing = true;
+
+      // The first affected token is the one containing pos. Tokens that start
+      // after it may shift, so they are all processed again.
+      size_t first = upper_bound(token_offsets.begin(), token_offsets.end(), pos)
+                     - token_offsets.begin();
+      if (first > 0) {
+        first--;
+      }
+      size_t start = first < token_offsets.size() ? token_offsets[first] : 0;
+
+      rollback_to(first);
+      expression.replace(pos, count, text);
 
-      vector<string> infix_tokens = tokenize_infix_expression();
-      process_infix_tokens(infix_tokens);
+      tokenize_infix_expression(start);
+      TRACE_TOKENIZED(expression_tokens);
+      process_infix_tokens_from(first);
 
-      return postfix_expression();
+      const string& postfix_exp = postfix_expression();
+      TRACE_CONVERTED();
+
+      return postfix_exp;
+    }
+
+    /**
+    * Returns where conversion stopped, if it did.
+    */
+    size_t invalid_token_offset() {
+      return invalid_offset;
     }
 
     /**
@@ -473,6 +2978,8 @@ namespace cop4530 {
     *   2. Duplication of postfix expression (if expression contains variables).
     */
     string evaluate() {
+      TRACE_EVALUATION_SCOPE();
+
       // Return the postfix expression if it contains any variables (since we
       // can't apply arithmetic to unknown values).
       if (has_vars) {
@@ -480,30 +2987,685 @@ namespace cop4530 {
         return pfexp + " = " + pfexp;
       }
 
-      // Calculate the expression (stored in operand stack)
-      evaluate_numerical_expression();
-
       string eval;     // holds the numerical evaluation (as a string)
 
-      // If expression is evaluated without errors, then the operand stack will
-      // contain a single element (the final value of the expression).
-      if (operand_stack.size() == 1) {
-        eval = to_string(operand_stack.top());
+      // Calculate the expression in the selected numeric type
+      switch (numeric_type) {
+        case NUMERIC_FLOAT:
+          eval = evaluate_numerical_expression<float>();
+          break;
+        case NUMERIC_DOUBLE:
+          eval = evaluate_numerical_expression<double>();
+          break;
+        case NUMERIC_LONG_DOUBLE:
+          eval = evaluate_numerical_expression<long double>();
+          break;
+        case NUMERIC_INT64:
+          eval = evaluate_numerical_expression<int64_t>();
+          break;
+        case NUMERIC_DECIMAL:
+          eval = evaluate_numerical_expression<Decimal>();
+          break;
+      }
 
-        // Formatting to remove trailing 0's
-        while (eval.back() == '0') {
-          eval.pop_back();
+      return postfix_expression() + " = " + eval;
+    }
+
+    /**
+    * Selects the numeric type by name. Returns false, leaving the current type
+    * selected, if the name is unknown.
+    */
+    bool set_numeric_type(const string& name) {
+      for (const auto& entry : numeric_type_names) {
+        if (name == entry.name) {
+          numeric_type = entry.type;
+          return true;
         }
+      }
 
-        // Remove . if no decimals
-        if (eval.back() == '.') {
-          eval.pop_back();
+      return false;
+    }
+
+    /**
+    * Returns the names of the variables used by accepted expressions, along
+    * with those of the expression being edited if it's valid as it stands.
+    */
+    vector<string> variables() {
+      vector<string> names;
+      names.reserve(used_variables.size());
+
+      for (uint32_t id : used_variables) {
+        names.push_back(symbols::name(id));
+      }
+
+      if (editing && invalid_offset == string::npos) {
+        vector<uint32_t> pending;
+        for (const PostfixToken& item : postfix_tokens) {
+          if (item.kind == TOKEN_VARIABLE
+              && (item.value >= variable_used.size() || !variable_used[item.value])
+              && find(pending.begin(), pending.end(), item.value) == pending.end()) {
+            pending.push_back(item.value);
+            names.push_back(symbols::name(item.value));
+          }
         }
       }
 
-      return postfix_expression() + " = " + eval;
+      return names;
+    }
+
+    /**
+    * Turns on profiling of converted expressions.
+    */
+    void start_profiling() {
+      profiling = true;
+    }
+
+    /**
+    * Writes one line per metric with its mean, 50th, 90th and 99th
+    * percentiles and maximum, followed by the operand mix.
+    */
+    void save_profile(const string& path) {
+      ofstream out(path);
+
+      out << "# in2post workload profile" << endl
+          << "expressions " << profile_metrics[METRIC_TOKENS].count << endl
+          << "# metric mean p50 p90 p99 max" << endl;
+
+      for (int m = 0; m < METRIC_COUNT; m++) {
+        const Histogram& h = profile_metrics[m];
+        out << metric_names[m] << ' ' << h.mean() << ' ' << h.percentile(0.5)
+            << ' ' << h.percentile(0.9) << ' ' << h.percentile(0.99) << ' '
+            << h.max << endl;
+      }
+
+      out << "variables " << profile_variables << endl
+          << "numbers " << profile_numbers << endl
+          << "variable_ratio "
+          << (profile_numbers == 0 ? 0.0 : double(profile_variables) / profile_numbers) << endl
+          << "distinct_variables " << symbols::count() << endl;
+
+      if (!out) {
+        error::throw_error(error::ERR_PROFILE_IO);
+      }
+    }
+
+    /**
+    * Reserves working buffers for the 99th percentile expression, so all but
+    * the largest expressions convert without growing them, and presizes the
+    * symbol table for the distinct variables seen.
+    *
+    * The batch chunk size is set to hold 4096 of the 99th percentile lines,
+    * within [MIN_CHUNK_SIZE, MAX_CHUNK_SIZE], so that short-line workloads
+    * scan chunks that stay in cache between the pre-pass and conversion.
+    */
+    void load_profile(const string& path) {
+      ifstream in(path);
+      if (!in) {
+        error::throw_error(error::ERR_PROFILE_IO);
+      }
+
+      uint64_t p99[METRIC_COUNT] = { 0, 0, 0, 0, 0 };
+      uint64_t distinct_variables = 0;
+      string line;
+
+      while (getline(in, line)) {
+        istringstream fields(line);
+        string name;
+        double mean;
+        uint64_t p50, p90;
+
+        fields >> name;
+
+        for (int m = 0; m < METRIC_COUNT; m++) {
+          if (name == metric_names[m] && !(fields >> mean >> p50 >> p90 >> p99[m])) {
+            error::throw_error(error::ERR_PROFILE_IO);
+          }
+        }
+
+        if (name == "distinct_variables") {
+          fields >> distinct_variables;
+        }
+      }
+
+      size_t tokens = p99[METRIC_TOKENS];
+      size_t bytes = p99[METRIC_BYTES];
+
+      expression_tokens.reserve(tokens);
+      token_offsets.reserve(tokens);
+      checkpoints.reserve(tokens);
+      postfix_tokens.reserve(tokens);
+      rendered_ends.reserve(tokens);
+      number_text.reserve(bytes + tokens);
+      postfix_text.reserve(bytes + tokens);
+      operator_stack.reserve(p99[METRIC_OPERATOR_DEPTH]);
+      reserved_operand_depth = p99[METRIC_OPERAND_DEPTH];
+      symbols::reserve(distinct_variables);
+
+      chunk_size = (bytes + 1) * 4096;
+      if (chunk_size < MIN_CHUNK_SIZE) {
+        chunk_size = MIN_CHUNK_SIZE;
+      }
+      else if (chunk_size > MAX_CHUNK_SIZE) {
+        chunk_size = MAX_CHUNK_SIZE;
+      }
+    }
+
+#ifdef IN2POST_TRACE_ALLOC
+    /**
+    * Prints the top expressions by bytes allocated, with each phase's share,
+    * followed by histograms of bytes allocated and peak live bytes per
+    * expression.
+    */
+    void print_allocation_report(ostream& out, int top) {
+      using namespace alloc_trace;
+
+      out << "Allocation trace: " << expressions << " expressions, " << allocations
+          << " allocations, " << allocated << " bytes" << endl;
+
+      if (top > top_size) {
+        top = top_size;
+      }
+
+      out << endl << "Top " << top << " expressions by bytes allocated:" << endl
+          << "line\tallocs\tbytes\tpeak";
+      for (int p = 0; p < PHASE_COUNT; p++) {
+        out << '\t' << phase_names[p];
+      }
+      out << "\texpression" << endl;
+
+      for (int i = 0; i < top; i++) {
+        const ExpressionTrace& t = alloc_trace::top[i];
+
+        out << t.line + 1 << '\t' << t.total_allocations() << '\t' << t.total_bytes()
+            << '\t' << t.peak;
+        for (int p = 0; p < PHASE_COUNT; p++) {
+          out << '\t' << t.bytes[p];
+        }
+        out << '\t' << t.text << endl;
+      }
+
+      const Histogram* histograms[] = { &bytes_per_expression, &peak_per_expression };
+      const char* titles[] = { "Bytes allocated", "Peak live bytes" };
+
+      for (int h = 0; h < 2; h++) {
+        out << endl << titles[h] << " per expression (mean " << histograms[h]->mean()
+            << ", max " << histograms[h]->max << "):" << endl;
+
+        for (int bits = 0; bits < 65; bits++) {
+          uint64_t count = histograms[h]->buckets[bits];
+          if (count == 0) {
+            continue;
+          }
+
+          uint64_t low = bits == 0 ? 0 : uint64_t(1) << (bits - 1);
+          out << "  >= " << low << "\t" << count << "\t"
+              << string(1 + 40 * count / histograms[h]->count, '#') << endl;
+        }
+      }
+    }
+#endif
+
+    /**
+    * Converts every line of a bulk input stream.
+    */
+    void convert_batch(istream& in, ostream& out) {
+      convert_chunks(in, out, numeric_limits<uint64_t>::max(),
+                     [](uint64_t, uint64_t) {});
+    }
+
+    /**
+    * Converts a range of lines of an input file.
+    *
+    * With an output file, progress is checkpointed after every chunk once
+    * the output up to that point has been synced to disk. Resuming truncates
+    * the output back to the last checkpoint, so lines are never written
+    * twice, and refuses to resume if the output is shorter than that.
+    */
+    void convert_file(const BatchJob& job) {
+      Checkpoint start = { file_stamp(job.input), job.first_line, job.end_line,
+                           job.first_line, 0, 0 };
+      string checkpoint_path = job.output.empty() ? "" : job.output + ".ckpt";
+      bool resumed = false;
+
+      if (job.resume) {
+        if (checkpoint_path.empty()) {
+          error::throw_error(error::ERR_CHECKPOINT_MISMATCH);
+        }
+
+        Checkpoint saved;
+        resumed = read_checkpoint(checkpoint_path, saved);
+
+        if (resumed) {
+          if (saved.input != start.input || saved.first_line != job.first_line
+              || saved.end_line != job.end_line) {
+            error::throw_error(error::ERR_CHECKPOINT_MISMATCH);
+          }
+
+          start = saved;
+        }
+      }
+
+      if (!resumed) {
+        start.input_offset = job.first_line == 0 ? 0 : line_offset(job.input, job.first_line);
+      }
+
+#ifdef IN2POST_TRACE_ALLOC
+      alloc_trace::first_line = start.next_line;
+#endif
+
+      ifstream in(job.input, ios::binary);
+      in.seekg(start.input_offset);
+
+      ofstream file;
+      if (!job.output.empty()) {
+        if (resumed) {
+          // The checkpoint can't vouch for output that has gone missing
+          struct stat st;
+          if (stat(job.output.c_str(), &st) != 0 || uint64_t(st.st_size) < start.output_offset) {
+            error::throw_error(error::ERR_CHECKPOINT_MISMATCH);
+          }
+
+          // Drop anything written after the checkpoint, then continue from it
+          if (truncate(job.output.c_str(), start.output_offset) != 0) {
+            error::throw_error(error::ERR_FILE_IO);
+          }
+          file.open(job.output, ios::binary | ios::in | ios::out);
+          file.seekp(start.output_offset);
+        }
+        else {
+          file.open(job.output, ios::binary | ios::trunc);
+        }
+
+        if (!file) {
+          error::throw_error(error::ERR_FILE_IO);
+        }
+      }
+      ostream& out = job.output.empty() ? cout : file;
+
+      if (!in) {
+        error::throw_error(error::ERR_FILE_IO);
+      }
+
+      uint64_t remaining = job.end_line > start.next_line ? job.end_line - start.next_line : 0;
+
+      convert_chunks(in, out, remaining, [&](uint64_t lines, uint64_t bytes) {
+        out.flush();
+        if (!out) {
+          error::throw_error(error::ERR_FILE_IO);
+        }
+
+        if (!checkpoint_path.empty()) {
+          // The output must be on disk before a checkpoint can count it
+          if (sync_file(job.output) != error::ERR_NONE) {
+            error::throw_error(error::ERR_FILE_IO);
+          }
+
+          Checkpoint progress = start;
+          progress.next_line = start.next_line + lines;
+          progress.input_offset = start.input_offset + bytes;
+          progress.output_offset = file.tellp();
+          write_checkpoint(checkpoint_path, progress);
+        }
+      });
+    }
+
+    /**
+    * Converts the formula's expression and records which names it refers
+    * to, replacing any earlier formula with the same name.
+    *
+    * An assignment without a proper name is reported and skipped. A formula
+    * whose expression has an invalid token or is incomplete is kept, and
+    * shows the error as its result.
+    */
+    void set_formula(const string& assignment) {
+      size_t equals = assignment.find(" = ");
+      if (equals == string::npos || !is_variable(assignment.substr(0, equals))) {
+        error::report_error(error::ERR_INVALID_ASSIGNMENT);
+        return;
+      }
+
+      // Convert as convert() does, but keep going past an invalid token
+      reset();
+      convert_edit(0, 0, assignment.substr(equals + 3));
+      editing = false;
+
+      error::ErrorCode invalid = error::ERR_NONE;
+      if (invalid_offset != string::npos) {
+        invalid = error::ERR_INVALID_TOKEN;
+      }
+      else {
+        record_variables();
+        if (profiling) {
+          record_profile(expression_tokens);
+        }
+      }
+
+      uint32_t name = symbols::intern(assignment.substr(0, equals));
+
+      formula_of_symbol.resize(symbols::count(), -1);
+      dependents.resize(symbols::count());
+
+      int index = formula_of_symbol[name];
+      if (index < 0) {
+        index = formulas.size();
+        formula_of_symbol[name] = index;
+        formulas.push_back(Formula());
+        formulas[index].name = name;
+        formulas[index].state = FORMULA_UNRESOLVED;
+      }
+
+      Formula& f = formulas[index];
+
+      // Forget what the old definition referred to
+      for (uint32_t symbol : f.inputs) {
+        vector<uint32_t>& d = dependents[symbol];
+        d.erase(remove(d.begin(), d.end(), uint32_t(index)), d.end());
+      }
+
+      f.postfix = postfix_tokens;
+      f.number_text = number_text;
+      f.postfix_text = postfix_expression();
+      f.invalid = invalid;
+      f.inputs.clear();
+
+      for (const PostfixToken& item : postfix_tokens) {
+        if (item.kind == TOKEN_VARIABLE) {
+          f.inputs.push_back(item.value);
+        }
+      }
+      sort(f.inputs.begin(), f.inputs.end());
+      f.inputs.erase(unique(f.inputs.begin(), f.inputs.end()), f.inputs.end());
+
+      for (uint32_t symbol : f.inputs) {
+        dependents[symbol].push_back(index);
+      }
+
+      changed_formulas.push_back(index);
+    }
+
+    /**
+    * Recalculates the sheet in the selected numeric type.
+    */
+    void recalculate(ostream& out) {
+      switch (numeric_type) {
+        case NUMERIC_FLOAT:
+          recalculate_as<float>(out);
+          break;
+        case NUMERIC_DOUBLE:
+          recalculate_as<double>(out);
+          break;
+        case NUMERIC_LONG_DOUBLE:
+          recalculate_as<long double>(out);
+          break;
+        case NUMERIC_INT64:
+          recalculate_as<int64_t>(out);
+          break;
+        case NUMERIC_DECIMAL:
+          recalculate_as<Decimal>(out);
+          break;
+      }
+    }
+
+    /**
+    * Runs each available block classifier over a large synthetic input and
+    * reports how many gigabytes of input it can split into classified tokens
+    * per second. Then converts a slice of the input end to end, both through
+    * convert_batch() and a line at a time through convert(), which matches
+    * each token against the regular expressions instead.
+    */
+    void benchmark_tokenizer(ostream& out) {
+      const size_t INPUT_SIZE = size_t(256) << 20;
+      const size_t SLICE_SIZE = size_t(4) << 20;
+      const int ROUNDS = 5;
+
+      const char* lines[] = {
+        "( 5 + 3 ) * 12 - 7\n",
+        "5 + 3 * 12 - 7\n",
+        "a + b1 * c + ( dd * e + f ) * G\n",
+        "( 3 * 5 - c ) / 10\n"
+      };
+
+      string input;
+      input.reserve(INPUT_SIZE + 64);
+      for (size_t i = 0; input.size() < INPUT_SIZE; i++) {
+        input += lines[i % 4];
+      }
+
+      struct Candidate {
+        const char* name;
+        BlockClassifier classify;
+      };
+
+      vector<Candidate> candidates = { { "scalar", classify_block_scalar } };
+#ifdef IN2POST_X86
+      if (__builtin_cpu_supports("sse2")) {
+        candidates.push_back({ "sse2", classify_block_sse2 });
+      }
+      if (__builtin_cpu_supports("avx2")) {
+        candidates.push_back({ "avx2", classify_block_avx2 });
+      }
+#endif
+
+      vector<size_t> seps;
+      vector<InfixKind> kinds;
+      seps.reserve(input.size() / 2);
+      kinds.reserve(input.size() / 2);
+
+      for (const Candidate& c : candidates) {
+        double best = 0.0;    // best throughput seen across rounds, in GB/s
+
+        for (int round = 0; round < ROUNDS; round++) {
+          auto start = chrono::steady_clock::now();
+          find_separators(c.classify, input.data(), input.size(), seps, kinds);
+          chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+          double gbps = input.size() / elapsed.count() / 1e9;
+          if (gbps > best) {
+            best = gbps;
+          }
+        }
+
+        out << c.name << ": " << best << " GB/s (" << seps.size()
+            << " separators in " << input.size() << " bytes)" << endl;
+      }
+
+      string slice = input.substr(0, input.rfind('\n', SLICE_SIZE) + 1);
+      ostream discard(nullptr);   // evaluations are formatted, then dropped
+
+      istringstream batch_in(slice);
+      auto start = chrono::steady_clock::now();
+      convert_batch(batch_in, discard);
+      chrono::duration<double> batch = chrono::steady_clock::now() - start;
+
+      istringstream line_in(slice);
+      string line;
+      start = chrono::steady_clock::now();
+      while (getline(line_in, line)) {
+        convert(line);
+        discard << evaluate() << '\n';
+      }
+      chrono::duration<double> single = chrono::steady_clock::now() - start;
+
+      out << "convert_batch(): " << slice.size() / batch.count() / 1e9 << " GB/s" << endl
+          << "convert() per line: " << slice.size() / single.count() / 1e9 << " GB/s" << endl;
+    }
+
+    /**
+    * Types a 10,000 token expression one character at a time. Every keystroke
+    * is converted with convert_edit(), and a sample of keystrokes is also
+    * converted from scratch with convert() for comparison.
+    */
+    void benchmark_incremental(ostream& out) {
+      const size_t TOKENS = 10000;
+      const size_t FULL_SAMPLE = 64;    // run convert() every this many keystrokes
+
+      // Every prefix of this pattern is a valid partial expression
+      const char* pattern[] = {
+        "(", "a1", "+", "2", ")", "*", "b", "-", "34", "/", "c", "+"
+      };
+
+      string target;
+      for (size_t i = 0; i < TOKENS; i++) {
+        if (i > 0) {
+          target += ' ';
+        }
+        target += pattern[i % 12];
+      }
+
+      convert("");
+      auto start = chrono::steady_clock::now();
+      for (size_t i = 0; i < target.size(); i++) {
+        convert_edit(i, 0, target.substr(i, 1));
+      }
+      chrono::duration<double> incremental = chrono::steady_clock::now() - start;
+      string incremental_result = postfix_expression();
+
+      size_t samples = 0;
+      start = chrono::steady_clock::now();
+      for (size_t i = 0; i < target.size(); i += FULL_SAMPLE) {
+        convert(target.substr(0, i + 1));
+        samples++;
+      }
+      chrono::duration<double> full = chrono::steady_clock::now() - start;
+
+      bool match = convert(target) == incremental_result;
+
+      out << "keystrokes: " << target.size() << " (" << TOKENS << " tokens)" << endl
+          << "incremental: " << incremental.count() / target.size() * 1e6
+          << " us/keystroke" << endl
+          << "full: " << full.count() / samples * 1e6 << " us/keystroke ("
+          << samples << " sampled)" << endl
+          << "results " << (match ? "match" : "DIFFER") << endl;
+    }
+
+    /**
+    * Evaluates the converted expression rounds times in one numeric type and
+    * reports the time per postfix token along with the result. Operands are
+    * parsed once up front, so only the arithmetic is timed.
+    */
+    template <typename Number>
+    void benchmark_evaluation(ostream& out, const char* name, int rounds) {
+      vector<Number> numbers;
+      const vector<Number> no_variables;
+      Number result;
+
+      error::ErrorCode err = parse_numbers(postfix_tokens, number_text, numbers);
+
+      auto start = chrono::steady_clock::now();
+      for (int round = 0; round < rounds && err == error::ERR_NONE; round++) {
+        err = evaluate_parsed_expression(postfix_tokens, numbers, no_variables, result);
+      }
+      chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+
+      if (err != error::ERR_NONE) {
+        error::throw_error(err);
+      }
+
+      out << name << ": " << elapsed.count() / rounds / postfix_tokens.size() * 1e9
+          << " ns/token (= " << format_number(result) << ")" << endl;
+    }
+
+    /**
+    * Converts a 20,000 term numerical expression once and evaluates it in
+    * every numeric type.
+    */
+    void benchmark_numeric(ostream& out) {
+      const size_t TERMS = 20000;
+      const int ROUNDS = 20;
+
+      string exp;
+      for (size_t i = 0; i < TERMS; i++) {
+        if (i > 0) {
+          exp += " + ";
+        }
+        exp += "( 5 + 3 ) * 2.0 - 7 / 4";   // int64 rejects a fraction like 2.5
+      }
+      convert(exp);
+
+      out << "postfix tokens: " << postfix_tokens.size() << endl;
+      benchmark_evaluation<float>(out, "float", ROUNDS);
+      benchmark_evaluation<double>(out, "double", ROUNDS);
+      benchmark_evaluation<long double>(out, "long-double", ROUNDS);
+      benchmark_evaluation<int64_t>(out, "int64", ROUNDS);
+      benchmark_evaluation<Decimal>(out, "decimal", ROUNDS);
     }
 
   }   // end of namespace in2post
 
 }   // end of namespace cop4530
+
+
+#ifdef IN2POST_TRACE_ALLOC
+//------------------------------------------------------------------------------
+//                  Counting global allocation hooks
+//------------------------------------------------------------------------------
+
+// Room kept in front of each block to remember its size, preserving the
+// alignment malloc() guarantees
+const size_t ALLOC_HEADER = 16;
+
+// Takes and returns the blocks from malloc() outside the replaced operators,
+// so the compiler doesn't pair free() with operator new's pointer (which
+// -Wmismatched-new-delete reports)
+__attribute__((noinline)) static void* allocate_block(size_t size) {
+  char* block = static_cast<char*>(malloc(size + ALLOC_HEADER));
+  if (block == nullptr) {
+    return nullptr;
+  }
+
+  *reinterpret_cast<size_t*>(block) = size;
+  in2post::alloc_trace::on_allocate(size);
+
+  return block + ALLOC_HEADER;
+}
+
+__attribute__((noinline)) static void release_block(void* ptr) {
+  char* block = static_cast<char*>(ptr) - ALLOC_HEADER;
+  in2post::alloc_trace::on_free(*reinterpret_cast<size_t*>(block));
+  free(block);
+}
+
+void* operator new(size_t size) {
+  void* ptr = allocate_block(size);
+  if (ptr == nullptr) {
+    throw bad_alloc();
+  }
+
+  return ptr;
+}
+
+void* operator new[](size_t size) {
+  return operator new(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) noexcept {
+  try {
+    return operator new(size);
+  }
+  catch (const bad_alloc&) {
+    return nullptr;
+  }
+}
+
+void* operator new[](size_t size, const nothrow_t& tag) noexcept {
+  return operator new(size, tag);
+}
+
+void operator delete(void* ptr) noexcept {
+  if (ptr != nullptr) {
+    release_block(ptr);
+  }
+}
+
+void operator delete[](void* ptr) noexcept {
+  operator delete(ptr);
+}
+
+void operator delete(void* ptr, const nothrow_t&) noexcept {
+  operator delete(ptr);
+}
+
+void operator delete[](void* ptr, const nothrow_t&) noexcept {
+  operator delete(ptr);
+}
+#endif
@@ -38,6 +38,7 @@ namespace cop4530 {
       bool empty() const;      // check if stack is empty
       void clear();            // delete all elements in the stack
       int size() const;        // number of elements in the stack
+      void reserve(int n);     // allocate room for n elements up front
 
       void push(const T& x);   // add a copy of x to the stack
       void push(T&& x);        // move x to the stack
@@ -67,6 +67,12 @@ int Stack<T>::size() const {
   return this->v.size();
 }
 
+// Allocate room for n elements so pushes up to that size don't reallocate
+template <typename T>
+void Stack<T>::reserve(int n) {
+  this->v.reserve(n);
+}
+
 // Add a copy of x to the stack
 template <typename T>
 void Stack<T>::push(const T& x) {
@@ -0,0 +1,155 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Pulls in the module's internals, leaving out its main()
+#define IN2POST_NO_MAIN
+#include "in2post.cpp"
+
+using namespace std;
+using namespace cop4530;
+
+/**
+* Tokens whose kind hinges on a single byte: empty tokens, dots at either
+* end, repeated dots, underscores, operators and parentheses that come in
+* pairs, and bytes outside ASCII.
+*/
+const char* edge_tokens[] = {
+  "", "1", "12", "1.", ".5", "1.5", "1..5", "1.5.2", "12.34", "0.0.",
+  "a", "a1", "a_", "_a", "1a", "a.b", "Z9_z", "_", "9_",
+  "+", "-", "*", "/", "++", "+-", "-1", "(", ")", "()", "((", ")(",
+  "\xc3\xa9", "a\xc3\xa9", "1\xff", "\x80", "#", "a#", "\t", "a\tb", "~"
+};
+
+/**
+* Returns a random token drawn from bytes that matter to the classifiers,
+* up to 150 bytes long so that some span two or three blocks.
+*/
+string random_token(unsigned& seed) {
+  static const string bytes = "0123456789.....abcXYZ_+-*/()\xc3\xa9\xff#";
+
+  seed = seed * 1103515245 + 12345;
+  size_t length = (seed >> 16) % 8 == 0 ? (seed >> 8) % 150 : (seed >> 8) % 6;
+
+  // Mostly draw from one class, so valid tokens turn up often
+  seed = seed * 1103515245 + 12345;
+  size_t lo = 0, hi = bytes.size();
+  switch ((seed >> 16) % 4) {
+    case 0: hi = 15; break;   // digits and dots
+    case 1: lo = 10; hi = 22; break;   // dots and identifiers
+    case 2: lo = 22; hi = 28; break;   // operators and parentheses
+  }
+
+  string token;
+  for (size_t i = 0; i < length; i++) {
+    seed = seed * 1103515245 + 12345;
+    token += bytes[lo + (seed >> 16) % (hi - lo)];
+  }
+
+  return token;
+}
+
+/**
+* Runs a classifier over text and checks that it finds every separator and
+* gives each token the kind classify_infix_token() gives it. Returns the
+* number of mismatches.
+*/
+int check_classifier(const char* name, in2post::BlockClassifier classify,
+                     const string& text, size_t& tokens) {
+  vector<size_t> seps;
+  vector<in2post::InfixKind> kinds;
+  int mismatches = 0;
+
+  in2post::find_separators(classify, text.data(), text.size(), seps, kinds);
+
+  size_t start = 0;
+  size_t next = 0;
+  tokens = 0;
+
+  for (size_t pos = 0; pos <= text.size(); pos++) {
+    if (pos < text.size() && text[pos] != ' ' && text[pos] != '\n') {
+      continue;
+    }
+
+    if (pos < text.size() && (next >= seps.size() || seps[next] != pos)) {
+      cout << name << ": missed separator at " << pos << endl;
+      return mismatches + 1;
+    }
+
+    string token = text.substr(start, pos - start);
+    if (kinds[next] != in2post::classify_infix_token(token)) {
+      if (mismatches++ < 10) {
+        cout << name << ": token \"" << token << "\" at " << start
+             << " classified as " << int(kinds[next]) << ", expected "
+             << int(in2post::classify_infix_token(token)) << endl;
+      }
+    }
+
+    tokens++;
+    next++;
+    start = pos + 1;
+  }
+
+  if (next != seps.size() + 1) {
+    cout << name << ": found " << seps.size() << " separators, expected "
+         << next - 1 << endl;
+    mismatches++;
+  }
+
+  return mismatches;
+}
+
+int main() {
+  string text;
+
+  // Every edge token at every offset within a block and across its end
+  for (const char* token : edge_tokens) {
+    for (size_t pad = 0; pad < 2 * in2post::BLOCK_SIZE; pad++) {
+      text += string(pad, 'a') + ' ' + token + '\n';
+    }
+  }
+
+  // Random lines of random tokens, some empty and some spanning blocks
+  unsigned seed = 26;
+  for (int line = 0; line < 20000; line++) {
+    seed = seed * 1103515245 + 12345;
+    int count = 1 + (seed >> 16) % 12;
+
+    for (int i = 0; i < count; i++) {
+      text += (i > 0 ? " " : "") + random_token(seed);
+    }
+    text += '\n';
+  }
+
+  // Leave the last token without a separator after it
+  text += "1.5";
+
+  struct {
+    const char* name;
+    in2post::BlockClassifier classify;
+    bool supported;
+  } classifiers[] = {
+    { "scalar", in2post::classify_block_scalar, true },
+#ifdef IN2POST_X86
+    { "sse2", in2post::classify_block_sse2, bool(__builtin_cpu_supports("sse2")) },
+    { "avx2", in2post::classify_block_avx2, bool(__builtin_cpu_supports("avx2")) },
+#endif
+  };
+
+  int failures = 0;
+
+  for (const auto& c : classifiers) {
+    if (!c.supported) {
+      cout << c.name << ": not supported by this CPU, skipped" << endl;
+      continue;
+    }
+
+    size_t tokens = 0;
+    int mismatches = check_classifier(c.name, c.classify, text, tokens);
+
+    cout << c.name << ": " << tokens << " tokens, " << mismatches << " mismatches" << endl;
+    failures += mismatches;
+  }
+
+  return failures == 0 ? 0 : 1;
+}
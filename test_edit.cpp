@@ -0,0 +1,157 @@
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Pulls in the module's internals, leaving out its main()
+#define IN2POST_NO_MAIN
+#include "in2post.cpp"
+
+using namespace std;
+using namespace cop4530;
+
+/**
+* What a conversion left behind: the postfix expression, where conversion
+* stopped, and the evaluation.
+*/
+struct Result {
+  string expression;
+  string postfix;
+  size_t invalid_offset;
+  string evaluation;
+};
+
+Result current_result(const string& expression, const string& postfix) {
+  return { expression, postfix, in2post::invalid_token_offset(), in2post::evaluate() };
+}
+
+/**
+* Converts the expression from scratch. A valid expression goes through
+* convert(); convert() exits on an invalid one, so that is inserted into an
+* empty expression instead.
+*/
+Result fresh_result(const string& expression) {
+  in2post::reset();
+  string postfix = in2post::convert_edit(0, 0, expression);
+
+  if (in2post::invalid_token_offset() == string::npos) {
+    postfix = in2post::convert(expression);
+  }
+
+  return current_result(expression, postfix);
+}
+
+unsigned next_random(unsigned& seed, unsigned n) {
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) % n;
+}
+
+const char* random_token(unsigned& seed) {
+  static const char* tokens[] = {
+    "1", "23", "4.5", "0.25", "x", "ab", "c_1", "(", "(", ")", "+", "-", "*", "/"
+  };
+
+  return tokens[next_random(seed, 14)];
+}
+
+/**
+* An edit: replace count characters at pos with text.
+*/
+struct Edit {
+  size_t pos;
+  size_t count;
+  string text;
+};
+
+/**
+* Returns a random edit of the expression. Most replace, insert or delete
+* whole tokens, which keeps the expression valid more often than not; the
+* rest type or erase at the end, or change a few characters anywhere, which
+* can split or join tokens and leave invalid ones behind.
+*/
+Edit random_edit(const string& expression, unsigned& seed) {
+  static const string bytes = "0123456789.()+-*/ab_ ";
+
+  vector<size_t> starts;   // offset of each token
+  starts.push_back(0);
+  for (size_t i = 0; i < expression.size(); i++) {
+    if (expression[i] == ' ') {
+      starts.push_back(i + 1);
+    }
+  }
+
+  size_t t = next_random(seed, starts.size());
+  size_t token_end = t + 1 < starts.size() ? starts[t + 1] - 1 : expression.size();
+
+  switch (next_random(seed, 8)) {
+    case 0:   // replace a token
+      return { starts[t], token_end - starts[t], random_token(seed) };
+    case 1:   // insert a token before another
+      return { starts[t], 0, random_token(seed) + string(expression.empty() ? "" : " ") };
+    case 2:   // delete a token and the space after it
+      return { starts[t], min(token_end + 1, expression.size()) - starts[t], "" };
+    case 3:   // type a character at the end
+      return { expression.size(), 0, string(1, bytes[next_random(seed, bytes.size())]) };
+    case 4:   // erase the last character
+      return { expression.size() - !expression.empty(), size_t(!expression.empty()), "" };
+    default: {  // change a few characters anywhere
+      size_t pos = next_random(seed, expression.size() + 1);
+      size_t count = next_random(seed, min(expression.size() - pos, size_t(3)) + 1);
+      string text;
+      for (unsigned n = next_random(seed, 3); n > 0; n--) {
+        text += bytes[next_random(seed, bytes.size())];
+      }
+      return { pos, count, text };
+    }
+  }
+}
+
+int main() {
+  const int SEQUENCES = 600;
+  const int EDITS = 200;
+
+  unsigned seed = 28;
+  int mismatches = 0;
+  size_t checked = 0;
+
+  for (int s = 0; s < SEQUENCES; s++) {
+    // Record every state of the sequence first, since a fresh conversion
+    // would replace the checkpoints the next edit depends on
+    vector<Result> results;
+    string expression;
+
+    in2post::reset();
+
+    for (int e = 0; e < EDITS; e++) {
+      Edit edit = random_edit(expression, seed);
+
+      // Keep expressions short enough that edits land all over them
+      if (expression.size() > 60) {
+        edit = { 0, min(expression.find(' '), expression.size() - 1) + 1, "" };
+      }
+
+      expression.replace(edit.pos, edit.count, edit.text);
+      string postfix = in2post::convert_edit(edit.pos, edit.count, edit.text);
+      results.push_back(current_result(expression, postfix));
+    }
+
+    for (const Result& incremental : results) {
+      Result fresh = fresh_result(incremental.expression);
+      checked++;
+
+      if (incremental.postfix != fresh.postfix
+          || incremental.invalid_offset != fresh.invalid_offset
+          || incremental.evaluation != fresh.evaluation) {
+        if (mismatches++ < 10) {
+          cout << "\"" << incremental.expression << "\": incremental \""
+               << incremental.evaluation << "\" stopping at " << int(incremental.invalid_offset)
+               << ", fresh \"" << fresh.evaluation << "\" stopping at "
+               << int(fresh.invalid_offset) << endl;
+        }
+      }
+    }
+  }
+
+  cout << checked << " edits, " << mismatches << " mismatches" << endl;
+
+  return mismatches == 0 ? 0 : 1;
+}